@@ -0,0 +1,583 @@
+/*
+ compare.c
+ ---
+ Benchmarks microshell against whichever of dash, bash and busybox sh are installed.
+ Every shell runs the same generated scripts on its standard input, and the results are
+ reported as a table on stdout and as JSON.
+
+ Build and run from the repository root:
+
+   cc -O2 -o microshell microshell.c
+   cc -O2 -o compare bench/compare.c -lm
+   ./compare [-r runs] [-o results.json] ./microshell
+
+ Latency percentiles are taken over the wall time of the individual runs of a workload.
+ Peak RSS is the largest resident set of the shell or any command it waited for, as
+ reported by wait4().
+
+ A last measurement, run in this process, compares the two ways of dispatching a word
+ among the arms of a case statement: trying each glob in turn with fnmatch(), and one
+ anchored extended regex holding every arm as an alternative, which is how microshell
+ compiles [[ word == 'arm|arm|...' ]].
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <time.h>
+#include <fnmatch.h>
+#include <regex.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+
+#define MAX_SHELLS 5
+#define MAX_RUNS 1000
+#define MAX_PATH_LEN 512
+#define DATA_LINES 20000
+
+
+// a shell under test, the arguments that make it read a script from stdin and an
+// optional NAME=value setting for its environment
+typedef struct _shell{
+    const char *name;
+    char path[MAX_PATH_LEN];
+    const char *extraArg;
+    char *environment;
+} shell_t;
+
+
+// a workload script and the number of commands it runs
+typedef struct _workload{
+    const char *name;
+    int commands;
+    void (*generate)(FILE *script, const char *dir);
+} workload_t;
+
+
+// measurements of one workload under one shell
+typedef struct _result{
+    double mean, p50, p90, p99;
+    double throughput;
+    long peakRss;
+    int failures;
+} result_t;
+
+
+
+int findInPath(const char *name, char *path);
+int runScript(const shell_t *shell, const char *scriptPath, double *seconds, long *maxRss);
+double percentile(double *sorted, int count, double p);
+int compareDoubles(const void *a, const void *b);
+void generateSpawn(FILE *script, const char *dir);
+void generatePipeline(FILE *script, const char *dir);
+void generateRedirect(FILE *script, const char *dir);
+void generateOneLiner(FILE *script, const char *dir);
+void generateLongLine(FILE *script, const char *dir);
+void generateText(FILE *script, const char *dir);
+void generateFilters(FILE *script, const char *dir);
+int benchmarkDispatch(int runs, double *sequential, double *combined);
+
+
+#define SPAWN_LINES 1000
+#define PIPELINE_LINES 100
+#define PIPELINE_STAGES 8
+#define REDIRECT_LINES 300
+#define ONELINER_LINES 20
+#define ONELINER_COMMANDS 30
+#define LONGLINE_COMMANDS 100000
+#define TEXT_LINES 50
+#define TEXT_STAGES 5
+#define FILTERS_LINES 100
+#define FILTERS_STAGES 4
+#define DISPATCH_ARMS 50
+#define DISPATCH_WORDS 10000
+
+
+workload_t workloads[] = {
+    {"spawn", SPAWN_LINES, generateSpawn},
+    {"pipeline", PIPELINE_LINES * PIPELINE_STAGES, generatePipeline},
+    {"redirect", REDIRECT_LINES, generateRedirect},
+    {"oneliner", ONELINER_LINES * ONELINER_COMMANDS, generateOneLiner},
+    {"longline", LONGLINE_COMMANDS, generateLongLine},
+    {"text", TEXT_LINES * TEXT_STAGES, generateText},
+    {"filters", FILTERS_LINES * FILTERS_STAGES, generateFilters},
+};
+#define NUM_WORKLOADS ((int)(sizeof(workloads) / sizeof(workloads[0])))
+
+
+
+/*
+ Main function. Finds the shells, generates the workloads and runs each workload under
+ each shell, then prints the results.
+ */
+int main(int argc, char **argv){
+
+    shell_t shells[MAX_SHELLS];
+    result_t results[MAX_SHELLS][NUM_WORKLOADS];
+    double samples[MAX_RUNS];
+    char dir[] = "/tmp/msbench-XXXXXX";
+    char scriptPath[MAX_PATH_LEN];
+    const char *jsonPath = "bench-results.json";
+    int runs = 5;
+    int numShells = 0;
+    int opt, s, w, r, dispatched;
+    long maxRss;
+    double total, sequential, combined;
+    FILE *file, *json;
+
+
+    while((opt = getopt(argc, argv, "r:o:")) != -1){
+        if(opt == 'r'){
+            runs = atoi(optarg);
+        }
+        else if(opt == 'o'){
+            jsonPath = optarg;
+        }
+        else{
+            optind = argc+1;
+            break;
+        }
+    }
+    if(optind != argc-1 || runs < 1 || runs > MAX_RUNS){
+        fprintf(stderr, "Usage: %s [-r runs] [-o results.json] path/to/microshell\n", argv[0]);
+        return 1;
+    }
+
+    for(s=0; s < MAX_SHELLS; ++s){
+        shells[s].environment = 0;
+    }
+    shells[numShells].name = "microshell";
+    snprintf(shells[numShells].path, MAX_PATH_LEN, "%s", argv[optind]);
+    shells[numShells++].extraArg = 0;
+    // the same binary with its fusion of grep, cut and head pipelines turned on
+    shells[numShells].name = "fused";
+    snprintf(shells[numShells].path, MAX_PATH_LEN, "%s", argv[optind]);
+    shells[numShells].environment = "MICROSHELL_FUSION=1";
+    shells[numShells++].extraArg = 0;
+    if(findInPath("dash", shells[numShells].path)){
+        shells[numShells].name = "dash";
+        shells[numShells++].extraArg = 0;
+    }
+    if(findInPath("bash", shells[numShells].path)){
+        shells[numShells].name = "bash";
+        shells[numShells++].extraArg = 0;
+    }
+    if(findInPath("busybox", shells[numShells].path)){
+        shells[numShells].name = "busybox";
+        shells[numShells++].extraArg = "sh";
+    }
+
+
+    // generate the input data and one script per workload
+    if(!mkdtemp(dir)){
+        fprintf(stderr, "Error! Could not create a working directory.\n");
+        return 1;
+    }
+    snprintf(scriptPath, MAX_PATH_LEN, "%s/data", dir);
+    file = fopen(scriptPath, "w");
+    for(r=0; r < DATA_LINES; ++r){
+        fprintf(file, "word%d %d\n", r % 97, r);
+    }
+    fclose(file);
+
+    for(w=0; w < NUM_WORKLOADS; ++w){
+        snprintf(scriptPath, MAX_PATH_LEN, "%s/%s.sh", dir, workloads[w].name);
+        file = fopen(scriptPath, "w");
+        workloads[w].generate(file, dir);
+        fclose(file);
+    }
+
+
+    for(s=0; s < numShells; ++s){
+        for(w=0; w < NUM_WORKLOADS; ++w){
+            snprintf(scriptPath, MAX_PATH_LEN, "%s/%s.sh", dir, workloads[w].name);
+            results[s][w].peakRss = 0;
+            results[s][w].failures = 0;
+            total = 0;
+
+            for(r=0; r < runs; ++r){
+                if(runScript(shells+s, scriptPath, samples+r, &maxRss) != 0){
+                    ++results[s][w].failures;
+                }
+                if(maxRss > results[s][w].peakRss){
+                    results[s][w].peakRss = maxRss;
+                }
+                total += samples[r];
+            }
+
+            qsort(samples, runs, sizeof(double), compareDoubles);
+            results[s][w].mean = total / runs;
+            results[s][w].p50 = percentile(samples, runs, 0.50);
+            results[s][w].p90 = percentile(samples, runs, 0.90);
+            results[s][w].p99 = percentile(samples, runs, 0.99);
+            results[s][w].throughput = workloads[w].commands / results[s][w].mean;
+        }
+    }
+
+
+    printf("%-10s %-10s %12s %8s %10s %10s %10s %12s %5s\n", "workload", "shell", "commands/s",
+           "relative", "p50 ms", "p90 ms", "p99 ms", "peak RSS kB", "fail");
+    for(w=0; w < NUM_WORKLOADS; ++w){
+        for(s=0; s < numShells; ++s){
+            printf("%-10s %-10s %12.0f %8.2f %10.2f %10.2f %10.2f %12ld %5d\n", workloads[w].name,
+                   shells[s].name, results[s][w].throughput,
+                   results[s][w].throughput / results[0][w].throughput,
+                   results[s][w].p50 * 1000, results[s][w].p90 * 1000, results[s][w].p99 * 1000,
+                   results[s][w].peakRss, results[s][w].failures);
+        }
+    }
+
+    dispatched = benchmarkDispatch(runs, &sequential, &combined) == 0;
+    if(dispatched){
+        printf("\ndispatch of %d words among %d glob arms: fnmatch in turn %.0f ns/word, "
+               "combined regex %.0f ns/word (%.2fx)\n", DISPATCH_WORDS, DISPATCH_ARMS, sequential, combined,
+               sequential / combined);
+    }
+
+    json = fopen(jsonPath, "w");
+    if(!json){
+        fprintf(stderr, "Error! Could not write results to '%s'.\n", jsonPath);
+        return 1;
+    }
+    fprintf(json, "{\"runs\": %d, \"results\": [", runs);
+    for(w=0; w < NUM_WORKLOADS; ++w){
+        for(s=0; s < numShells; ++s){
+            fprintf(json, "%s\n  {\"workload\": \"%s\", \"shell\": \"%s\", \"commands\": %d, "
+                    "\"throughput\": %.1f, \"relative\": %.3f, \"mean_ms\": %.3f, \"p50_ms\": %.3f, "
+                    "\"p90_ms\": %.3f, \"p99_ms\": %.3f, \"peak_rss_kb\": %ld, \"failures\": %d}",
+                    (w || s) ? "," : "", workloads[w].name, shells[s].name, workloads[w].commands,
+                    results[s][w].throughput, results[s][w].throughput / results[0][w].throughput,
+                    results[s][w].mean * 1000, results[s][w].p50 * 1000, results[s][w].p90 * 1000,
+                    results[s][w].p99 * 1000, results[s][w].peakRss, results[s][w].failures);
+        }
+    }
+    fprintf(json, "\n]");
+    if(dispatched){
+        fprintf(json, ", \"dispatch\": {\"arms\": %d, \"words\": %d, \"fnmatch_ns\": %.1f, \"regex_ns\": %.1f}",
+                DISPATCH_ARMS, DISPATCH_WORDS, sequential, combined);
+    }
+    fprintf(json, "}\n");
+    fclose(json);
+
+    snprintf(scriptPath, MAX_PATH_LEN, "rm -rf %s", dir);
+    system(scriptPath);
+
+    return 0;
+}
+
+
+
+
+/*
+ Searches PATH for an executable with the given name. Returns 1 and stores its location
+ in *path if one is found, or 0 otherwise.
+ */
+int findInPath(const char *name, char *path){
+
+    const char *dirs = getenv("PATH");
+    const char *end;
+
+    while(dirs && *dirs){
+        end = strchr(dirs, ':');
+        if(!end){
+            end = dirs+strlen(dirs);
+        }
+        snprintf(path, MAX_PATH_LEN, "%.*s/%s", (int)(end-dirs), dirs, name);
+        if(access(path, X_OK) == 0){
+            return 1;
+        }
+        dirs = *end ? end+1 : end;
+    }
+    return 0;
+}
+
+
+
+
+/*
+ Runs the shell once with the script on its standard input and its output discarded.
+ Returns the shell's exit status.
+
+ Return parameters:
+  *seconds - the wall time of the run
+  *maxRss - the peak resident set size in kilobytes
+ */
+int runScript(const shell_t *shell, const char *scriptPath, double *seconds, long *maxRss){
+
+    struct timespec start, end;
+    struct rusage usage;
+    int status;
+    pid_t pid;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid = fork();
+
+    if(pid < 0){
+        fprintf(stderr, "Error! Could not fork process for shell '%s'.\n", shell->name);
+        exit(1);
+    }
+    else if(pid == 0){
+        dup2(open(scriptPath, O_RDONLY), fileno(stdin));
+        dup2(open("/dev/null", O_WRONLY), fileno(stdout));
+        if(shell->environment){
+            putenv(shell->environment);
+        }
+        execl(shell->path, shell->name, shell->extraArg, (char *)0);
+
+        fprintf(stderr, "Error! The shell '%s' could not be run.\n", shell->path);
+        _exit(127);
+    }
+
+    wait4(pid, &status, 0, &usage);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    *seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    *maxRss = usage.ru_maxrss;
+    return WEXITSTATUS(status);
+}
+
+
+
+
+/*
+ Returns the p-th percentile of count sorted samples using the nearest-rank method.
+ */
+double percentile(double *sorted, int count, double p){
+
+    int rank = (int)ceil(p * count);
+
+    if(rank < 1){
+        rank = 1;
+    }
+    return sorted[rank-1];
+}
+
+
+
+
+/*
+ Orders doubles ascending for qsort.
+ */
+int compareDoubles(const void *a, const void *b){
+
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+
+
+
+/*
+ Workload generators. Each script sticks to syntax that every shell under test accepts:
+ simple commands, &&, pipes and file redirects.
+ */
+void generateSpawn(FILE *script, const char *dir){
+
+    char truePath[MAX_PATH_LEN];
+    int i;
+
+    // use the full path so shells with a builtin true still spawn a process
+    (void)dir;
+    if(!findInPath("true", truePath)){
+        snprintf(truePath, MAX_PATH_LEN, "true");
+    }
+    for(i=0; i < SPAWN_LINES; ++i){
+        fprintf(script, "%s\n", truePath);
+    }
+}
+
+
+void generatePipeline(FILE *script, const char *dir){
+
+    int i, j;
+
+    for(i=0; i < PIPELINE_LINES; ++i){
+        fprintf(script, "cat %s/data", dir);
+        for(j=2; j < PIPELINE_STAGES; ++j){
+            fprintf(script, " | cat");
+        }
+        fprintf(script, " | wc -l\n");
+    }
+}
+
+
+void generateRedirect(FILE *script, const char *dir){
+
+    int i;
+
+    for(i=0; i < REDIRECT_LINES; ++i){
+        fprintf(script, "cat < %s/data %s %s/out%d\n", dir, (i % 2) ? ">>" : ">", dir, i % 10);
+    }
+}
+
+
+void generateOneLiner(FILE *script, const char *dir){
+
+    int i, j;
+
+    (void)dir;
+    for(i=0; i < ONELINER_LINES; ++i){
+        fprintf(script, "true");
+        for(j=1; j < ONELINER_COMMANDS; ++j){
+            fprintf(script, " && true");
+        }
+        fprintf(script, "\n");
+    }
+}
+
+
+/*
+ A single generated line of LONGLINE_COMMANDS commands. The first one fails, so the run
+ measures parsing and chain evaluation rather than process creation.
+ */
+void generateLongLine(FILE *script, const char *dir){
+
+    int i;
+
+    (void)dir;
+    fprintf(script, "false");
+    for(i=1; i < LONGLINE_COMMANDS; ++i){
+        fprintf(script, " && true");
+    }
+    fprintf(script, "\n");
+}
+
+
+void generateText(FILE *script, const char *dir){
+
+    int i;
+
+    for(i=0; i < TEXT_LINES; ++i){
+        fprintf(script, "grep %d %s/data | cut -d ' ' -f 1 | sort | uniq -c | sort -rn > %s/text%d\n",
+                i % 10, dir, dir, i % 10);
+    }
+}
+
+
+
+
+/*
+ Generates pipelines of grep, cut and head over the data file, alternating between one
+ that head cuts short and one that scans the whole file. Microshell runs these in a
+ single process when fusion is turned on.
+ */
+void generateFilters(FILE *script, const char *dir){
+
+    int i;
+
+    for(i=0; i < FILTERS_LINES; ++i){
+        if(i % 2){
+            fprintf(script, "grep -F word%d %s/data | grep -v 5 | cut -d ' ' -f 2 | head -100 > %s/filters%d\n",
+                    i % 97, dir, dir, i % 10);
+        }
+        else{
+            fprintf(script, "grep -F word%d %s/data | grep -v 5 | cut -d ' ' -f 2 | grep 1 > %s/filters%d\n",
+                    i % 97, dir, dir, i % 10);
+        }
+    }
+}
+
+
+
+
+/*
+ Times dispatching DISPATCH_WORDS words among DISPATCH_ARMS glob arms of the forms a case
+ statement typically has, with every fourth word matching none of them. The sequential
+ way tries the arms in turn with fnmatch() until one matches; the combined way translates
+ the arms as microshell does (* and ? to .* and ., brackets kept, dots escaped) into
+ ^(arm|arm|...)$, compiled once, and runs one regexec() per word. Returns 0 on success or
+ 1 if the regex does not compile or the two ways disagree about a word.
+
+ Return parameters:
+  *sequential - the mean nanoseconds per word trying the arms in turn
+  *combined - the mean nanoseconds per word with the combined regex
+ */
+int benchmarkDispatch(int runs, double *sequential, double *combined){
+
+    static char arms[DISPATCH_ARMS][32];
+    static char words[DISPATCH_WORDS][32];
+    static char source[DISPATCH_ARMS * 64 + 8];
+    static const char *templates[] = {"*.ext%d", "pre%d_*", "file%d.[ch]", "data%d?.txt", "[A-Z]log%d*"};
+    static const char *examples[] = {"name%d.ext%d", "pre%d_%d", "file%d.c", "data%dx.txt", "Klog%d_%d"};
+    struct timespec start, end;
+    regex_t regex;
+    char *out;
+    const char *c;
+    int r, i, a, matchesSequential = 0, matchesCombined = 0;
+
+
+    out = source;
+    *(out++) = '^';
+    *(out++) = '(';
+    for(a=0; a < DISPATCH_ARMS; ++a){
+        snprintf(arms[a], sizeof(arms[a]), templates[a % 5], a);
+        if(a){
+            *(out++) = '|';
+        }
+        for(c=arms[a]; *c; ++c){
+            if(*c == '*' || *c == '?'){
+                *(out++) = '.';
+                if(*c == '*'){
+                    *(out++) = '*';
+                }
+            }
+            else{
+                if(*c == '.'){
+                    *(out++) = '\\';
+                }
+                *(out++) = *c;
+            }
+        }
+    }
+    *(out++) = ')';
+    *(out++) = '$';
+    *out = 0;
+    if(regcomp(&regex, source, REG_EXTENDED | REG_NOSUB) != 0){
+        fprintf(stderr, "Error! Could not compile the combined dispatch pattern.\n");
+        return 1;
+    }
+
+    for(i=0; i < DISPATCH_WORDS; ++i){
+        a = (i * 7) % DISPATCH_ARMS;
+        if(i % 4 == 3){
+            snprintf(words[i], sizeof(words[i]), "other%d.bin", i);
+        }
+        else{
+            snprintf(words[i], sizeof(words[i]), examples[a % 5], a, i);
+        }
+    }
+
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(r=0; r < runs; ++r){
+        for(i=0; i < DISPATCH_WORDS; ++i){
+            for(a=0; a < DISPATCH_ARMS && fnmatch(arms[a], words[i], 0) != 0; ++a);
+            matchesSequential += (a < DISPATCH_ARMS);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    *sequential = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / ((double)runs * DISPATCH_WORDS);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(r=0; r < runs; ++r){
+        for(i=0; i < DISPATCH_WORDS; ++i){
+            matchesCombined += regexec(&regex, words[i], 0, 0, 0) == 0;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    *combined = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / ((double)runs * DISPATCH_WORDS);
+
+    regfree(&regex);
+    if(matchesSequential != matchesCombined){
+        fprintf(stderr, "Error! fnmatch matched %d words and the combined regex %d.\n",
+                matchesSequential, matchesCombined);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,766 @@
+/*
+ soak.c
+ ---
+ Load generator and soak test for microshell worker daemons, the shell's server mode.
+ Many concurrent client connections send a weighted mix of builtin-only, spawn and
+ pipeline requests, and the latency of every request, the errors and the daemon's file
+ descriptors and memory are reported once per interval, so a run of several hours shows
+ drift and leaks as well as tail latency.
+
+ Build and run from the repository root:
+
+   cc -O2 -o microshell microshell.c
+   cc -O2 -o soak bench/soak.c
+   ./microshell --worker 7101 &
+   ./soak [-c clients] [-r rate] [-t seconds] [-i interval] [-m builtin:spawn:pipeline]
+          [-p daemon-pid] [-o soak-results.json] host:port[,host:port...]
+
+ Daemons run commands rather than shell lines, so builtin and pipeline requests name
+ small microshell scripts written to a scratch directory; the daemon runs those in a fork
+ of itself without exec'ing anything for the builtins. Spawn requests run true.
+
+ With -r the requests are sent open-loop at a fixed rate, and a request that finds every
+ client busy waits in a backlog. Latency is measured from the time a request was due, not
+ the time it was sent, so a stalled daemon shows up in the percentiles instead of
+ silently slowing the load down. Without -r each client sends its next request as soon
+ as the last one finishes.
+
+ With -p the daemon and every process under it (one per connection) are sampled through
+ /proc for their number of open descriptors and resident set size.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include <dirent.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+
+#define MAX_CLIENTS 4096
+#define MAX_DAEMONS 64
+#define MAX_PATH_LEN 512
+#define MAX_BACKLOG 65536
+#define MAX_TREE_PROCS 8192
+#define FRAME_HEADER_LEN 5
+#define READ_BUFFER_LEN 65536
+#define RECONNECT_SECONDS 1.0
+
+// latencies are kept in microseconds in buckets that are exact below 128 and then split
+// every power of two into 64 steps, which bounds the error of a percentile to 1.6%
+#define HISTOGRAM_EXACT 128
+#define HISTOGRAM_STEPS 64
+#define HISTOGRAM_BUCKETS (HISTOGRAM_EXACT + 40 * HISTOGRAM_STEPS)
+
+
+// kinds of request
+#define REQUEST_BUILTIN 0
+#define REQUEST_SPAWN 1
+#define REQUEST_PIPELINE 2
+#define NUM_REQUEST_KINDS 3
+
+
+// a daemon address from the command line
+typedef struct _daemon{
+    char host[256];
+    char port[32];
+} daemon_t;
+
+
+// a client connection and the request it is waiting for
+typedef struct _client{
+    int fd;
+    int daemon;
+    int busy;
+    int kind;
+    double dueAt;
+    double retryAt;
+    unsigned char header[FRAME_HEADER_LEN];
+    int headerLength;
+    uint32_t payloadLeft;
+    unsigned char status[4];
+    int statusLength;
+} client_t;
+
+
+// a latency histogram
+typedef struct _histogram{
+    long counts[HISTOGRAM_BUCKETS];
+    long total;
+    long max;
+} histogram_t;
+
+
+// descriptors and memory of the daemon process tree at one point in time
+typedef struct _treeSample{
+    int processes;
+    long fds;
+    long rssKb;
+    long daemonFds;
+    long daemonRssKb;
+} tree_sample_t;
+
+
+
+double now(void);
+int connectDaemon(const daemon_t *daemon);
+int sendRequest(client_t *client, const char *path);
+int readResponse(client_t *client, int *finished, int *exitStatus);
+void recordLatency(histogram_t *histogram, long micros);
+long histogramPercentile(const histogram_t *histogram, double p);
+void sampleTree(pid_t root, tree_sample_t *sample);
+long readRss(pid_t pid);
+long countFds(pid_t pid);
+int writeScript(const char *path, const char *text);
+void stop(int sig);
+
+
+const char *kindNames[NUM_REQUEST_KINDS] = {"builtin", "spawn", "pipeline"};
+
+const char *builtinScript =
+    "[[ abc == a* ]] && [[ 10 -gt 9 ]]\n"
+    "array request a b c\n"
+    "[[ ${request[1]} == b ]]\n";
+
+const char *pipelineScript =
+    "echo soak request | cat | wc -c\n";
+
+volatile sig_atomic_t stopRequested = 0;
+
+
+
+/*
+ Main function. Connects the clients, drives the load until the run time is over or the
+ run is interrupted, then prints and writes a summary.
+ */
+int main(int argc, char **argv){
+
+    static client_t clients[MAX_CLIENTS];
+    static double backlog[MAX_BACKLOG];
+    static histogram_t interval, total, byKind[NUM_REQUEST_KINDS];
+    static struct pollfd pollers[MAX_CLIENTS];
+    daemon_t daemons[MAX_DAEMONS];
+    char requestPath[NUM_REQUEST_KINDS][MAX_PATH_LEN];
+    char dir[] = "/tmp/mssoak-XXXXXX";
+    const char *jsonPath = "soak-results.json";
+    const char *list, *end, *colon;
+    int weights[NUM_REQUEST_KINDS] = {1, 1, 1};
+    int numClients = 50, numDaemons = 0, weightTotal;
+    double rate = 0, duration = 60, reportEvery = 10;
+    pid_t daemonPid = 0;
+    long requests = 0, intervalRequests = 0, exitErrors = 0, connectionErrors = 0;
+    long intervalErrors = 0, dropped = 0, kindCount[NUM_REQUEST_KINDS] = {0, 0, 0};
+    int backlogHead = 0, backlogLength = 0;
+    double start, current, nextDue, nextReport, lastReport, wait;
+    tree_sample_t first, sample;
+    struct timespec timeout;
+    unsigned long random = 88172645463325252UL;
+    int opt, i, c, next = 0, finished, exitStatus, roll;
+    FILE *json;
+
+
+    while((opt = getopt(argc, argv, "c:r:t:i:m:p:o:")) != -1){
+        if(opt == 'c'){
+            numClients = atoi(optarg);
+        }
+        else if(opt == 'r'){
+            rate = atof(optarg);
+        }
+        else if(opt == 't'){
+            duration = atof(optarg);
+        }
+        else if(opt == 'i'){
+            reportEvery = atof(optarg);
+        }
+        else if(opt == 'm'){
+            sscanf(optarg, "%d:%d:%d", weights, weights+1, weights+2);
+        }
+        else if(opt == 'p'){
+            daemonPid = atoi(optarg);
+        }
+        else if(opt == 'o'){
+            jsonPath = optarg;
+        }
+        else{
+            optind = argc+1;
+            break;
+        }
+    }
+    weightTotal = weights[0] + weights[1] + weights[2];
+    if(optind != argc-1 || numClients < 1 || numClients > MAX_CLIENTS || reportEvery <= 0 ||
+       weights[0] < 0 || weights[1] < 0 || weights[2] < 0 || weightTotal <= 0){
+        fprintf(stderr, "Usage: %s [-c clients] [-r rate] [-t seconds] [-i interval] "
+                "[-m builtin:spawn:pipeline] [-p daemon-pid] [-o results.json] host:port[,host:port...]\n", argv[0]);
+        return 1;
+    }
+
+    for(list=argv[optind]; *list && numDaemons < MAX_DAEMONS; list = *end ? end+1 : end){
+        end = strchr(list, ',');
+        if(!end){
+            end = list+strlen(list);
+        }
+        for(colon=end-1; colon > list && *colon != ':'; --colon);
+        if(colon == list){
+            snprintf(daemons[numDaemons].host, sizeof(daemons[0].host), "127.0.0.1");
+            snprintf(daemons[numDaemons].port, sizeof(daemons[0].port), "%.*s", (int)(end-list), list);
+        }
+        else{
+            snprintf(daemons[numDaemons].host, sizeof(daemons[0].host), "%.*s", (int)(colon-list), list);
+            snprintf(daemons[numDaemons].port, sizeof(daemons[0].port), "%.*s", (int)(end-colon-1), colon+1);
+        }
+        ++numDaemons;
+    }
+
+
+    // write the scripts run by builtin and pipeline requests
+    if(!mkdtemp(dir)){
+        fprintf(stderr, "Error! Could not create a working directory.\n");
+        return 1;
+    }
+    snprintf(requestPath[REQUEST_BUILTIN], MAX_PATH_LEN, "%s/builtin", dir);
+    snprintf(requestPath[REQUEST_PIPELINE], MAX_PATH_LEN, "%s/pipeline", dir);
+    snprintf(requestPath[REQUEST_SPAWN], MAX_PATH_LEN, access("/bin/true", X_OK) == 0 ? "/bin/true" : "/usr/bin/true");
+    if(!writeScript(requestPath[REQUEST_BUILTIN], builtinScript) ||
+       !writeScript(requestPath[REQUEST_PIPELINE], pipelineScript)){
+        fprintf(stderr, "Error! Could not write the request scripts to '%s'.\n", dir);
+        return 1;
+    }
+
+    json = fopen(jsonPath, "w");
+    if(!json){
+        fprintf(stderr, "Error! Could not write results to '%s'.\n", jsonPath);
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+
+    for(c=0; c < numClients; ++c){
+        clients[c].daemon = c % numDaemons;
+        clients[c].fd = connectDaemon(daemons+clients[c].daemon);
+        clients[c].busy = 0;
+        clients[c].retryAt = 0;
+        if(clients[c].fd < 0){
+            fprintf(stderr, "Error! Could not connect to %s:%s.\n",
+                    daemons[clients[c].daemon].host, daemons[clients[c].daemon].port);
+            return 1;
+        }
+    }
+
+
+    sampleTree(daemonPid, &first);
+    printf("%9s %9s %9s %9s %9s %9s %7s %7s %6s %7s %10s\n", "elapsed s", "req/s", "p50 ms", "p99 ms",
+           "p99.9 ms", "max ms", "errors", "backlog", "procs", "fds", "RSS kB");
+    fprintf(json, "{\"clients\": %d, \"rate\": %.1f, \"mix\": [%d, %d, %d], \"intervals\": [",
+            numClients, rate, weights[0], weights[1], weights[2]);
+
+    start = lastReport = now();
+    nextDue = start;
+    nextReport = start + reportEvery;
+
+    while(!stopRequested){
+        current = now();
+        if(current - start >= duration){
+            break;
+        }
+
+        // queue the requests that have come due, then hand them to idle clients
+        while(rate > 0 && nextDue <= current){
+            if(backlogLength < MAX_BACKLOG){
+                backlog[(backlogHead + backlogLength++) % MAX_BACKLOG] = nextDue;
+            }
+            else{
+                ++dropped;
+            }
+            nextDue += 1 / rate;
+        }
+        for(i=0; i < numClients && (rate == 0 || backlogLength > 0); ++i){
+            c = (next + i) % numClients;
+            if(clients[c].busy || (clients[c].fd < 0 && current < clients[c].retryAt)){
+                continue;
+            }
+            if(clients[c].fd < 0){
+                clients[c].fd = connectDaemon(daemons+clients[c].daemon);
+                if(clients[c].fd < 0){
+                    ++connectionErrors;
+                    ++intervalErrors;
+                    clients[c].retryAt = current + RECONNECT_SECONDS;
+                    continue;
+                }
+            }
+
+            roll = random % weightTotal;
+            random ^= random << 13;
+            random ^= random >> 7;
+            random ^= random << 17;
+            for(clients[c].kind=0; roll >= weights[clients[c].kind]; roll -= weights[clients[c].kind++]);
+
+            if(rate > 0){
+                clients[c].dueAt = backlog[backlogHead];
+                backlogHead = (backlogHead + 1) % MAX_BACKLOG;
+                --backlogLength;
+            }
+            else{
+                clients[c].dueAt = current;
+            }
+            if(sendRequest(clients+c, requestPath[clients[c].kind]) < 0){
+                close(clients[c].fd);
+                clients[c].fd = -1;
+                ++connectionErrors;
+                ++intervalErrors;
+                continue;
+            }
+            clients[c].busy = 1;
+            next = c+1;
+        }
+
+
+        for(c=0; c < numClients; ++c){
+            pollers[c].fd = clients[c].busy ? clients[c].fd : -1;
+            pollers[c].events = POLLIN;
+            pollers[c].revents = 0;
+        }
+        wait = nextReport - current;
+        if(rate > 0 && nextDue - current < wait){
+            wait = nextDue - current;
+        }
+        wait = wait < 0 ? 0 : wait;
+        timeout.tv_sec = (time_t)wait;
+        timeout.tv_nsec = (long)((wait - timeout.tv_sec) * 1e9);
+        if(ppoll(pollers, numClients, &timeout, 0) < 0 && errno != EINTR){
+            fprintf(stderr, "Error! Could not wait for responses: %s.\n", strerror(errno));
+            break;
+        }
+
+        current = now();
+        for(c=0; c < numClients; ++c){
+            if(!pollers[c].revents){
+                continue;
+            }
+            if(readResponse(clients+c, &finished, &exitStatus) < 0){
+                close(clients[c].fd);
+                clients[c].fd = -1;
+                clients[c].busy = 0;
+                ++connectionErrors;
+                ++intervalErrors;
+                continue;
+            }
+            if(finished){
+                clients[c].busy = 0;
+                recordLatency(&interval, (long)((current - clients[c].dueAt) * 1e6));
+                recordLatency(&total, (long)((current - clients[c].dueAt) * 1e6));
+                recordLatency(byKind+clients[c].kind, (long)((current - clients[c].dueAt) * 1e6));
+                ++kindCount[clients[c].kind];
+                ++requests;
+                ++intervalRequests;
+                if(exitStatus != 0){
+                    ++exitErrors;
+                    ++intervalErrors;
+                }
+            }
+        }
+
+
+        if(current >= nextReport){
+            sampleTree(daemonPid, &sample);
+            printf("%9.0f %9.0f %9.2f %9.2f %9.2f %9.2f %7ld %7d %6d %7ld %10ld\n", current - start,
+                   intervalRequests / (current - lastReport), histogramPercentile(&interval, 0.50) / 1000.0,
+                   histogramPercentile(&interval, 0.99) / 1000.0, histogramPercentile(&interval, 0.999) / 1000.0,
+                   interval.max / 1000.0, intervalErrors, backlogLength, sample.processes, sample.fds, sample.rssKb);
+            fflush(stdout);
+            fprintf(json, "%s\n  {\"elapsed_s\": %.1f, \"requests_per_s\": %.1f, \"p50_ms\": %.3f, "
+                    "\"p99_ms\": %.3f, \"p999_ms\": %.3f, \"max_ms\": %.3f, \"errors\": %ld, \"backlog\": %d, "
+                    "\"processes\": %d, \"fds\": %ld, \"rss_kb\": %ld, \"daemon_fds\": %ld, \"daemon_rss_kb\": %ld}",
+                    lastReport > start ? "," : "", current - start, intervalRequests / (current - lastReport),
+                    histogramPercentile(&interval, 0.50) / 1000.0, histogramPercentile(&interval, 0.99) / 1000.0,
+                    histogramPercentile(&interval, 0.999) / 1000.0, interval.max / 1000.0, intervalErrors,
+                    backlogLength, sample.processes, sample.fds, sample.rssKb, sample.daemonFds, sample.daemonRssKb);
+            fflush(json);
+
+            memset(&interval, 0, sizeof(interval));
+            intervalRequests = intervalErrors = 0;
+            lastReport = current;
+            nextReport = current + reportEvery;
+        }
+    }
+
+
+    current = now();
+    sampleTree(daemonPid, &sample);
+    printf("\n%-9s %9s %9s %9s %9s %9s\n", "request", "count", "p50 ms", "p99 ms", "p99.9 ms", "max ms");
+    for(i=0; i < NUM_REQUEST_KINDS; ++i){
+        printf("%-9s %9ld %9.2f %9.2f %9.2f %9.2f\n", kindNames[i], kindCount[i],
+               histogramPercentile(byKind+i, 0.50) / 1000.0, histogramPercentile(byKind+i, 0.99) / 1000.0,
+               histogramPercentile(byKind+i, 0.999) / 1000.0, byKind[i].max / 1000.0);
+    }
+    printf("\n%ld requests in %.0f s (%.0f/s), %ld failed, %ld connection errors, %ld dropped from the backlog\n",
+           requests, current - start, requests / (current - start), exitErrors, connectionErrors, dropped);
+    if(daemonPid){
+        printf("daemon fds %ld -> %ld, daemon RSS %ld -> %ld kB, tree RSS %ld -> %ld kB\n", first.daemonFds,
+               sample.daemonFds, first.daemonRssKb, sample.daemonRssKb, first.rssKb, sample.rssKb);
+    }
+
+    fprintf(json, "\n], \"summary\": {\"seconds\": %.1f, \"requests\": %ld, \"requests_per_s\": %.1f, "
+            "\"failed\": %ld, \"connection_errors\": %ld, \"dropped\": %ld, \"daemon_fds_growth\": %ld, "
+            "\"daemon_rss_growth_kb\": %ld, \"tree_rss_growth_kb\": %ld, \"kinds\": [",
+            current - start, requests, requests / (current - start), exitErrors, connectionErrors, dropped,
+            sample.daemonFds - first.daemonFds, sample.daemonRssKb - first.daemonRssKb, sample.rssKb - first.rssKb);
+    for(i=0; i < NUM_REQUEST_KINDS; ++i){
+        fprintf(json, "%s\n  {\"kind\": \"%s\", \"requests\": %ld, \"p50_ms\": %.3f, \"p99_ms\": %.3f, "
+                "\"p999_ms\": %.3f, \"max_ms\": %.3f}", i ? "," : "", kindNames[i], kindCount[i],
+                histogramPercentile(byKind+i, 0.50) / 1000.0, histogramPercentile(byKind+i, 0.99) / 1000.0,
+                histogramPercentile(byKind+i, 0.999) / 1000.0, byKind[i].max / 1000.0);
+    }
+    fprintf(json, "\n]}}\n");
+    fclose(json);
+
+    unlink(requestPath[REQUEST_BUILTIN]);
+    unlink(requestPath[REQUEST_PIPELINE]);
+    rmdir(dir);
+
+    return (exitErrors || connectionErrors) ? 2 : 0;
+}
+
+
+
+
+/*
+ Returns the time on the monotonic clock in seconds.
+ */
+double now(void){
+
+    struct timespec time;
+
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+
+
+
+/*
+ Connects to a daemon. Returns the connected socket, or -1.
+ */
+int connectDaemon(const daemon_t *daemon){
+
+    struct addrinfo hints, *addresses;
+    int fd = -1, on = 1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(daemon->host, daemon->port, &hints, &addresses) != 0){
+        return -1;
+    }
+    fd = socket(addresses->ai_family, addresses->ai_socktype | SOCK_CLOEXEC, addresses->ai_protocol);
+    if(fd >= 0 && connect(fd, addresses->ai_addr, addresses->ai_addrlen) < 0){
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(addresses);
+    if(fd >= 0){
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    return fd;
+}
+
+
+
+
+/*
+ Sends a request to run the command at path with no input: a command frame holding the
+ path and an end of input frame. Returns 0 on success or -1 on error.
+ */
+int sendRequest(client_t *client, const char *path){
+
+    char frames[2*FRAME_HEADER_LEN + MAX_PATH_LEN];
+    uint32_t length = strlen(path)+1;
+    size_t used = 0;
+
+    frames[used] = 'C';
+    length = htonl(length);
+    memcpy(frames+used+1, &length, 4);
+    used += FRAME_HEADER_LEN;
+    memcpy(frames+used, path, strlen(path)+1);
+    used += strlen(path)+1;
+    frames[used] = 'E';
+    memset(frames+used+1, 0, 4);
+    used += FRAME_HEADER_LEN;
+
+    client->headerLength = 0;
+    client->payloadLeft = 0;
+    client->statusLength = 0;
+    return send(client->fd, frames, used, MSG_NOSIGNAL) == (ssize_t)used ? 0 : -1;
+}
+
+
+
+
+/*
+ Reads what the daemon has sent for the client's request. Output and error frames are
+ skipped; an exit frame finishes the request. Returns 0 on success or -1 if the connection
+ failed or the daemon broke the protocol.
+
+ Return parameters:
+  *finished - set if the request finished
+  *exitStatus - the exit status of the request if it finished
+ */
+int readResponse(client_t *client, int *finished, int *exitStatus){
+
+    static unsigned char buffer[READ_BUFFER_LEN];
+    ssize_t count, i = 0;
+    uint32_t length;
+    uint32_t take;
+
+    *finished = 0;
+    count = recv(client->fd, buffer, READ_BUFFER_LEN, MSG_DONTWAIT);
+    if(count <= 0){
+        return (count < 0 && (errno == EAGAIN || errno == EINTR)) ? 0 : -1;
+    }
+
+    while(i < count){
+        if(client->headerLength < FRAME_HEADER_LEN){
+            client->header[client->headerLength++] = buffer[i++];
+            if(client->headerLength == FRAME_HEADER_LEN){
+                memcpy(&length, client->header+1, 4);
+                client->payloadLeft = ntohl(length);
+                if(client->header[0] == 'X' && client->payloadLeft != 4){
+                    return -1;
+                }
+            }
+            else{
+                continue;
+            }
+        }
+        else{
+            take = count-i < (ssize_t)client->payloadLeft ? (uint32_t)(count-i) : client->payloadLeft;
+            if(client->header[0] == 'X'){
+                memcpy(client->status+client->statusLength, buffer+i, take);
+                client->statusLength += take;
+            }
+            i += take;
+            client->payloadLeft -= take;
+        }
+
+        if(client->payloadLeft == 0){
+            if(client->header[0] == 'X'){
+                memcpy(&length, client->status, 4);
+                *exitStatus = ntohl(length);
+                *finished = 1;
+                return i == count ? 0 : -1; // nothing may follow the exit frame
+            }
+            client->headerLength = 0;
+        }
+    }
+    return 0;
+}
+
+
+
+
+/*
+ Adds a latency in microseconds to the histogram.
+ */
+void recordLatency(histogram_t *histogram, long micros){
+
+    int shift = 0, bucket;
+
+    if(micros < 0){
+        micros = 0;
+    }
+    if(micros < HISTOGRAM_EXACT){
+        bucket = micros;
+    }
+    else{
+        while((micros >> shift) >= 2*HISTOGRAM_STEPS){
+            ++shift;
+        }
+        bucket = HISTOGRAM_EXACT + (shift-1) * HISTOGRAM_STEPS + (int)(micros >> shift) - HISTOGRAM_STEPS;
+        if(bucket >= HISTOGRAM_BUCKETS){
+            bucket = HISTOGRAM_BUCKETS-1;
+        }
+    }
+    ++histogram->counts[bucket];
+    ++histogram->total;
+    if(micros > histogram->max){
+        histogram->max = micros;
+    }
+}
+
+
+
+
+/*
+ Returns the p-th percentile of the histogram in microseconds, taken as the upper bound of
+ the bucket holding the nearest-rank sample, or 0 for an empty histogram.
+ */
+long histogramPercentile(const histogram_t *histogram, double p){
+
+    long rank = (long)(p * histogram->total + 0.999999), seen = 0;
+    long upper;
+    int bucket, shift;
+
+    if(histogram->total == 0){
+        return 0;
+    }
+    rank = rank < 1 ? 1 : rank;
+    for(bucket=0; bucket < HISTOGRAM_BUCKETS-1 && seen + histogram->counts[bucket] < rank; ++bucket){
+        seen += histogram->counts[bucket];
+    }
+    if(bucket < HISTOGRAM_EXACT){
+        upper = bucket;
+    }
+    else{
+        shift = (bucket - HISTOGRAM_EXACT) / HISTOGRAM_STEPS + 1;
+        upper = ((long)((bucket - HISTOGRAM_EXACT) % HISTOGRAM_STEPS + HISTOGRAM_STEPS + 1) << shift) - 1;
+    }
+    return upper < histogram->max ? upper : histogram->max;
+}
+
+
+
+
+/*
+ Samples the number of processes, open descriptors and resident memory of root and every
+ process below it. Leaves the sample zeroed if root is 0.
+ */
+void sampleTree(pid_t root, tree_sample_t *sample){
+
+    static pid_t queue[MAX_TREE_PROCS];
+    char path[MAX_PATH_LEN];
+    int head = 0, tail = 0;
+    pid_t child;
+    FILE *file;
+    DIR *tasks;
+    struct dirent *task;
+
+    memset(sample, 0, sizeof(*sample));
+    if(!root){
+        return;
+    }
+    sample->daemonFds = countFds(root);
+    sample->daemonRssKb = readRss(root);
+
+    queue[tail++] = root;
+    while(head < tail){
+        ++sample->processes;
+        sample->fds += countFds(queue[head]);
+        sample->rssKb += readRss(queue[head]);
+
+        snprintf(path, MAX_PATH_LEN, "/proc/%d/task", (int)queue[head]);
+        tasks = opendir(path);
+        while(tasks && (task = readdir(tasks))){
+            if(task->d_name[0] == '.'){
+                continue;
+            }
+            snprintf(path, MAX_PATH_LEN, "/proc/%d/task/%s/children", (int)queue[head], task->d_name);
+            file = fopen(path, "r");
+            while(file && tail < MAX_TREE_PROCS && fscanf(file, "%d", &child) == 1){
+                queue[tail++] = child;
+            }
+            if(file){
+                fclose(file);
+            }
+        }
+        if(tasks){
+            closedir(tasks);
+        }
+        ++head;
+    }
+}
+
+
+
+
+/*
+ Returns the resident set size of a process in kilobytes, or 0 if it has gone.
+ */
+long readRss(pid_t pid){
+
+    char path[MAX_PATH_LEN], line[256];
+    long rss = 0;
+    FILE *status;
+
+    snprintf(path, MAX_PATH_LEN, "/proc/%d/status", (int)pid);
+    status = fopen(path, "r");
+    while(status && fgets(line, sizeof(line), status)){
+        if(sscanf(line, "VmRSS: %ld", &rss) == 1){
+            break;
+        }
+    }
+    if(status){
+        fclose(status);
+    }
+    return rss;
+}
+
+
+
+
+/*
+ Returns the number of descriptors a process has open, or 0 if it has gone.
+ */
+long countFds(pid_t pid){
+
+    char path[MAX_PATH_LEN];
+    long count = 0;
+    DIR *fds;
+    struct dirent *entry;
+
+    snprintf(path, MAX_PATH_LEN, "/proc/%d/fd", (int)pid);
+    fds = opendir(path);
+    while(fds && (entry = readdir(fds))){
+        count += entry->d_name[0] != '.';
+    }
+    if(fds){
+        closedir(fds);
+    }
+    return count;
+}
+
+
+
+
+/*
+ Writes an executable script holding text to path. Returns 1 on success or 0 on error.
+ */
+int writeScript(const char *path, const char *text){
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0755);
+    ssize_t length = strlen(text);
+
+    if(fd < 0){
+        return 0;
+    }
+    if(write(fd, text, length) != length){
+        close(fd);
+        return 0;
+    }
+    return close(fd) == 0;
+}
+
+
+
+
+/*
+ Ends the run early and still reports the results.
+ */
+void stop(int sig){
+
+    (void)sig;
+    stopRequested = 1;
+}
@@ -0,0 +1,333 @@
+/*
+ startup.c
+ ---
+ Measures how long a container entrypoint takes to start its first program: the time
+ from creating the container's first process to the first exec of a command from the
+ entrypoint line. Microshell runs the line as microshell --init -c line, and whichever of
+ dash, bash and busybox sh are installed run it as sh -c line. Each run starts in a new
+ PID namespace, so the shell is PID 1 as it would be in a container; without the
+ privileges for that, the shells run as ordinary children and the report says so.
+
+ Build and run from the repository root:
+
+   cc -O2 -o microshell microshell.c
+   cc -Os -static -s -DNO_USDT_PROBES -o microshell-static microshell.c
+   cc -O2 -o startup bench/startup.c -lm
+   ./startup [-r runs] [-o results.json] ./microshell [./microshell-static ...]
+
+ The command on the line is this program run with --probe, which writes the time it
+ reached main to its standard output and exits, so every shell's figure includes the same
+ startup of the probe. The exit time covers the whole run, up to the moment the shell was
+ reaped.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <math.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+
+
+#define MAX_SHELLS 8
+#define MAX_RUNS 10000
+#define MAX_PATH_LEN 512
+
+
+// a shell under test and the arguments before the line it runs
+typedef struct _shell{
+    const char *name;
+    char path[MAX_PATH_LEN];
+    const char *args[3];
+} shell_t;
+
+
+// measurements of one shell
+typedef struct _result{
+    double p50, p90, p99;
+    double exitMean;
+    int failures;
+} result_t;
+
+
+
+int findInPath(const char *name, char *path);
+int startShell(const shell_t *shell, const char *line, int isolate, double *firstExec, double *exited);
+double now(void);
+double percentile(double *sorted, int count, double p);
+int compareDoubles(const void *a, const void *b);
+
+
+
+/*
+ Main function. Runs the entrypoint line under each shell and prints the latency to the
+ first exec, or acts as the probe command when run with --probe.
+ */
+int main(int argc, char **argv){
+
+    shell_t shells[MAX_SHELLS];
+    result_t results[MAX_SHELLS];
+    double samples[MAX_RUNS];
+    char self[MAX_PATH_LEN], line[MAX_PATH_LEN + 16];
+    const char *jsonPath = "startup-results.json";
+    int runs = 200;
+    int numShells = 0;
+    int isolate = 1;
+    int opt, s, r, failed;
+    double firstExec, exited, exitTotal;
+    ssize_t length;
+    FILE *json;
+
+
+    if(argc == 2 && strcmp(argv[1], "--probe") == 0){
+        printf("%.9f\n", now());
+        return 0;
+    }
+
+    while((opt = getopt(argc, argv, "r:o:")) != -1){
+        if(opt == 'r'){
+            runs = atoi(optarg);
+        }
+        else if(opt == 'o'){
+            jsonPath = optarg;
+        }
+        else{
+            optind = argc+1;
+            break;
+        }
+    }
+    if(optind >= argc || argc-optind > MAX_SHELLS-3 || runs < 1 || runs > MAX_RUNS){
+        fprintf(stderr, "Usage: %s [-r runs] [-o results.json] path/to/microshell...\n", argv[0]);
+        return 1;
+    }
+
+    length = readlink("/proc/self/exe", self, MAX_PATH_LEN-1);
+    if(length < 0){
+        fprintf(stderr, "Error! Could not find the path of this program.\n");
+        return 1;
+    }
+    self[length] = 0;
+    snprintf(line, sizeof(line), "%s --probe", self);
+
+    for(; optind < argc; ++optind){
+        shells[numShells].name = argv[optind];
+        snprintf(shells[numShells].path, MAX_PATH_LEN, "%s", argv[optind]);
+        shells[numShells].args[0] = "--init";
+        shells[numShells].args[1] = "-c";
+        shells[numShells++].args[2] = 0;
+    }
+    if(findInPath("dash", shells[numShells].path)){
+        shells[numShells].name = "dash";
+        shells[numShells].args[0] = "-c";
+        shells[numShells++].args[1] = 0;
+    }
+    if(findInPath("bash", shells[numShells].path)){
+        shells[numShells].name = "bash";
+        shells[numShells].args[0] = "-c";
+        shells[numShells++].args[1] = 0;
+    }
+    if(findInPath("busybox", shells[numShells].path)){
+        shells[numShells].name = "busybox";
+        shells[numShells].args[0] = "sh";
+        shells[numShells].args[1] = "-c";
+        shells[numShells++].args[2] = 0;
+    }
+
+
+    for(s=0; s < numShells; ++s){
+        results[s].failures = 0;
+        exitTotal = 0;
+
+        for(r=0; r < runs; ++r){
+            failed = startShell(shells+s, line, isolate, &firstExec, &exited);
+            if(failed < 0 && isolate){
+                // no privileges for a PID namespace; the shells run as plain children
+                isolate = 0;
+                failed = startShell(shells+s, line, isolate, &firstExec, &exited);
+            }
+            results[s].failures += (failed != 0);
+            samples[r] = firstExec;
+            exitTotal += exited;
+        }
+
+        qsort(samples, runs, sizeof(double), compareDoubles);
+        results[s].p50 = percentile(samples, runs, 0.50);
+        results[s].p90 = percentile(samples, runs, 0.90);
+        results[s].p99 = percentile(samples, runs, 0.99);
+        results[s].exitMean = exitTotal / runs;
+    }
+
+
+    printf("%s\n", isolate ? "each run as PID 1 of a new PID namespace" :
+                             "each run as a plain child (no privileges for PID namespaces)");
+    printf("%-24s %10s %10s %10s %12s %5s\n", "shell", "p50 us", "p90 us", "p99 us", "exit us", "fail");
+    for(s=0; s < numShells; ++s){
+        printf("%-24s %10.0f %10.0f %10.0f %12.0f %5d\n", shells[s].name, results[s].p50 * 1e6,
+               results[s].p90 * 1e6, results[s].p99 * 1e6, results[s].exitMean * 1e6, results[s].failures);
+    }
+
+    json = fopen(jsonPath, "w");
+    if(!json){
+        fprintf(stderr, "Error! Could not write results to '%s'.\n", jsonPath);
+        return 1;
+    }
+    fprintf(json, "[");
+    for(s=0; s < numShells; ++s){
+        fprintf(json, "%s\n  {\"shell\": \"%s\", \"pid1\": %s, \"runs\": %d, \"first_exec_p50_us\": %.1f, "
+                "\"first_exec_p90_us\": %.1f, \"first_exec_p99_us\": %.1f, \"exit_mean_us\": %.1f, "
+                "\"failures\": %d}", s ? "," : "", shells[s].name, isolate ? "true" : "false", runs,
+                results[s].p50 * 1e6, results[s].p90 * 1e6, results[s].p99 * 1e6,
+                results[s].exitMean * 1e6, results[s].failures);
+    }
+    fprintf(json, "\n]\n");
+    fclose(json);
+    return 0;
+}
+
+
+
+
+/*
+ Looks up name in the directories of PATH. Returns 1 and the full path in path if found.
+ */
+int findInPath(const char *name, char *path){
+
+    const char *dirs = getenv("PATH");
+    const char *end;
+
+    while(dirs && *dirs){
+        end = strchr(dirs, ':');
+        if(!end){
+            end = dirs+strlen(dirs);
+        }
+        snprintf(path, MAX_PATH_LEN, "%.*s/%s", (int)(end-dirs), dirs, name);
+        if(access(path, X_OK) == 0){
+            return 1;
+        }
+        dirs = *end ? end+1 : end;
+    }
+    return 0;
+}
+
+
+
+
+/*
+ Starts the shell on the line, as PID 1 of a new PID namespace if isolate is set, and
+ waits for it. Returns 0 if the probe ran and the shell exited with status 0, 1 if not,
+ and -1 if no PID namespace could be created.
+
+ Return parameters:
+  *firstExec - the seconds from the start of the shell's process to the probe's exec
+  *exited - the seconds from the start of the shell's process until it was reaped
+ */
+int startShell(const shell_t *shell, const char *line, int isolate, double *firstExec, double *exited){
+
+    const char *argList[6];
+    char output[64];
+    double start, probed = 0;
+    ssize_t got, length = 0;
+    int outputPipe[2];
+    int status, i;
+    pid_t pid;
+
+    argList[0] = shell->name;
+    for(i=0; shell->args[i]; ++i){
+        argList[i+1] = shell->args[i];
+    }
+    argList[i+1] = line;
+    argList[i+2] = 0;
+
+    if(pipe(outputPipe) < 0){
+        fprintf(stderr, "Error! Could not create a pipe for shell '%s'.\n", shell->name);
+        exit(1);
+    }
+
+    // a clone without a new stack returns twice like fork
+    start = now();
+    pid = isolate ? syscall(SYS_clone, CLONE_NEWPID | SIGCHLD, 0, 0, 0, 0) : fork();
+    if(pid < 0 && isolate){
+        close(outputPipe[0]);
+        close(outputPipe[1]);
+        return -1;
+    }
+    else if(pid < 0){
+        fprintf(stderr, "Error! Could not fork process for shell '%s'.\n", shell->name);
+        exit(1);
+    }
+    else if(pid == 0){
+        dup2(outputPipe[1], fileno(stdout));
+        close(outputPipe[0]);
+        close(outputPipe[1]);
+        execv(shell->path, (char **)argList);
+
+        fprintf(stderr, "Error! The shell '%s' could not be run.\n", shell->path);
+        _exit(127);
+    }
+
+    close(outputPipe[1]);
+    while((got = read(outputPipe[0], output+length, sizeof(output)-1-length)) > 0){
+        length += got;
+    }
+    close(outputPipe[0]);
+    waitpid(pid, &status, 0);
+    *exited = now() - start;
+
+    output[length] = 0;
+    if(sscanf(output, "%lf", &probed) == 1){
+        *firstExec = probed - start;
+    }
+    else{
+        *firstExec = *exited;
+    }
+    return !(probed > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+
+
+
+/*
+ Returns the monotonic clock in seconds. It is the same in every PID namespace.
+ */
+double now(void){
+
+    struct timespec time;
+
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+
+
+
+/*
+ Returns the p-th percentile of count sorted samples using the nearest-rank method.
+ */
+double percentile(double *sorted, int count, double p){
+
+    int rank = (int)ceil(p * count);
+
+    if(rank < 1){
+        rank = 1;
+    }
+    return sorted[rank-1];
+}
+
+
+
+
+/*
+ Orders doubles ascending for qsort.
+ */
+int compareDoubles(const void *a, const void *b){
+
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
@@ -7,6 +7,8 @@
  Author: Michael Falcone
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <memory.h>
 #include <stdlib.h>
@@ -15,12 +17,123 @@
 #include <signal.h>
 #include <string.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <regex.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <time.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/random.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
 #include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <linux/audit.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+#include <linux/taskstats.h>
+
+
+/*
+ USDT probes for perf and bpftrace, compiled in when <sys/sdt.h> is available and the
+ build does not define NO_USDT_PROBES. A disabled probe is a single nop, so they stay in
+ release builds; the README lists the probes and their arguments.
+ */
+#if !defined(NO_USDT_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define HAVE_USDT_PROBES
+#endif
+#endif
+
+#ifdef HAVE_USDT_PROBES
+#define PROBE1(name, a) DTRACE_PROBE1(microshell, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(microshell, name, a, b)
+#else
+#define PROBE1(name, a)
+#define PROBE2(name, a, b)
+#endif
+
+
+/*
+ Whether a stream already holds input that was read ahead. There is no standard call for
+ it: glibc keeps the read pointers in the FILE itself, and musl provides __freadahead().
+ */
+#ifdef __GLIBC__
+#define INPUT_BUFFERED(stream) ((stream)->_IO_read_ptr < (stream)->_IO_read_end)
+#else
+#include <stdio_ext.h>
+#define INPUT_BUFFERED(stream) (__freadahead(stream) > 0)
+#endif
+
+
+#define MAX_PARALLEL_JOBS 64
+#define COPY_BUFFER_LEN 65536
+#define REPLICA_BLOCK_LEN 262144
+#define REPLICA_FLUSH_MILLIS 100
+#define PARTITION_BATCH_LEN 16384
+#define NO_PARTITION -1
+#define MAX_PATH_LEN 4096
+#define MAX_CONFIG_ALIASES 64
+#define MAX_CONFIG_LIMITS 16
+#define MAX_JOBS 256
+#define DEFAULT_JOB_QUEUE 64
+#define MAX_ARRAYS 64
+#define MAX_ARRAY_NAME_LEN 64
+#define MAX_SUBSCRIPT_LEN 4096
+#define PATTERN_CACHE_SIZE 64
+#define FORK_RETRIES 8
+#define FORK_BACKOFF_MICROS 1000
+#define SPAN_BATCH_LEN 64
+#define MAX_SPAN_NAME_LEN 64
+#define TRACE_BUFFER_LEN (SPAN_BATCH_LEN * 2048)
+#define MAX_SECCOMP_NOTIF_LEN 512
+#define CACHE_FORMAT "microshell-cache 1"
+#define MAX_WORKERS 64
+#define MAX_HOST_LEN 256
+#define MAX_REMOTE_TASKS 256
+#define REMOTE_TASK_LEN 1048576
+#define MAX_TASK_ATTEMPTS 3
+#define MAX_FRAME_LEN 65536
+#define MAX_WRITE_OPTIONS 16
+#define DEFAULT_SYNC_STRIDE (8 << 20)
+#define NETLINK_BUFFER_LEN 2048
+#define FRAME_HEADER_LEN 5
+#define MAX_WARM_CHILDREN 16
+#define WARM_MESSAGE_LEN 65536
+#define MAX_SCHEDULES 4096
+#define MAX_SCHEDULE_LEN 512
+#define MAX_SCHEDULE_RUNS 256
+#define TICK_MILLIS 100
+#define WHEEL_LEVELS 4
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define MAX_FUSED_FILTERS 16
+#define MAX_FIELD_RANGES 16
 
 
-#define MAX_INPUT_LEN 256
+// the seccomp architecture the cache builtin traces input files on
+#if defined(__x86_64__)
+#define TRACE_AUDIT_ARCH AUDIT_ARCH_X86_64
+#elif defined(__aarch64__)
+#define TRACE_AUDIT_ARCH AUDIT_ARCH_AARCH64
+#endif
 
 
 #define ISWHITESPACE(c) (c == ' ' || c == '\t' || c == '\n')
@@ -45,62 +158,722 @@
 typedef char* arg_t;
 
 
-// represents a command in a command chain
+// flags describing how a command connects to the next one in its chain
+#define CMD_STOP_ON_FAILURE 0x01
+#define CMD_STOP_ON_SUCCESS 0x02
+#define CMD_PIPED 0x04
+#define CMD_BACKGROUND 0x08
+
+#define NO_COMMAND UINT32_MAX
+
+
+// represents a command in a command chain; arguments and the next command are
+// 32-bit indices into the arena of the line the command was parsed from
 typedef struct _command{
-    arg_t *argList;
+    uint32_t argIndex;
+    uint32_t next;
     int fdIn;
     int fdOut;
-    int stopOnFailure;
-    int stopOnSuccess;
-    int piped;
-    int background;
-    struct _command *next;
+    uint16_t replicas;
+    int16_t partitionField;
+    uint8_t flags;
 } command_t;
 
 
+// the buffers an input line is parsed into, grown to fit the longest line seen
+typedef struct _lineArena{
+    char *argBuffer;
+    arg_t *argList;
+    command_t *commands;
+    size_t capacity;
+} line_arena_t;
+
+
+#define COMMAND_ARGS(com) (lineArena.argList+(com)->argIndex)
+#define NEXT_COMMAND(com) ((com)->next == NO_COMMAND ? 0 : lineArena.commands+(com)->next)
+
+
+// write-back controls of an output redirect written as >{...} file; they are kept for
+// the line being run and found by the file descriptor of the redirect
+typedef struct _writeOptions{
+    int fd;
+    off_t prealloc;
+    off_t syncStride;
+    int dropCache;
+} write_options_t;
+
+
+// a snapshot of the settings loaded from the rc file; every string points into text
+typedef struct _config{
+    char *text;
+    char **envp;
+    arg_t *aliasArgs;
+    int aliasStart[MAX_CONFIG_ALIASES];
+    int numAliases;
+    int limitResource[MAX_CONFIG_LIMITS];
+    struct rlimit limitValue[MAX_CONFIG_LIMITS];
+    int numLimits;
+    int jobSlots;
+    int jobQueue;
+    int warmChildren;
+} config_t;
+
+
+// kinds of shell array
+#define ARRAY_FREE 0
+#define ARRAY_INDEXED 1
+#define ARRAY_ASSOCIATIVE 2
+
+
+// a shell array. Indexed arrays keep count elements in items; associative arrays keep an
+// open-addressing table of capacity slots in items, key and value side by side. Every
+// string lives in text, which is either owned memory or a private mapping of a file.
+typedef struct _array{
+    char name[MAX_ARRAY_NAME_LEN];
+    int type;
+    arg_t *items;
+    size_t count;
+    size_t capacity;
+    char *text;
+    size_t textLength;
+    int mapped;
+} array_t;
+
+
+// a compiled [[ ]] pattern, cached by its source text; globs are compiled to regexes
+typedef struct _pattern{
+    char *source;
+    int isGlob;
+    regex_t regex;
+} pattern_t;
+
+
+// what a command name resolves to through PATH
+#define COMMAND_NOT_FOUND 0
+#define COMMAND_PROGRAM 1
+#define COMMAND_SCRIPT 2
+
+
+// frame types of the protocol between pmap -w and worker daemons
+#define FRAME_COMMAND 'C'
+#define FRAME_INPUT 'I'
+#define FRAME_END 'E'
+#define FRAME_OUTPUT 'O'
+#define FRAME_ERROR 'R'
+#define FRAME_EXIT 'X'
+
+
+// states of a pmap task run by worker daemons
+#define TASK_PENDING 0
+#define TASK_RUNNING 1
+#define TASK_DONE 2
+#define TASK_FAILED 3
+
+
+// a connection to a worker daemon and the task it is running, or -1
+typedef struct _worker{
+    char host[MAX_HOST_LEN];
+    char port[32];
+    int fd;
+    int task;
+} worker_t;
+
+
+// states of a background job
+#define JOB_FREE 0
+#define JOB_QUEUED 1
+#define JOB_RUNNING 2
+#define JOB_DONE 3
+
+
+// a background job; queued jobs are forked but blocked until they are given a slot
+typedef struct _job{
+    int id;
+    int state;
+    pid_t pid;
+    int startFd;
+    int exitStatus;
+    unsigned long sequence;
+    struct timespec queuedAt;
+    long waitMicros;
+} job_t;
+
+
+// a child forked ahead of time and parked on its end of a control socket, from which it
+// receives a command to exec
+typedef struct _warmChild{
+    pid_t pid;
+    int controlFd;
+} warm_child_t;
+
+
+// the head of a message handing a command to a warm child; the program's path, argc
+// arguments and envc environment variables follow it as strings, and the command's
+// standard input, output and error come with it as SCM_RIGHTS
+typedef struct _warmCommand{
+    int argc;
+    int envc;
+    int numLimits;
+    int limitResource[MAX_CONFIG_LIMITS];
+    struct rlimit limitValue[MAX_CONFIG_LIMITS];
+} warm_command_t;
+
+
+// kinds of text filter a pipeline can be fused from
+#define FILTER_MATCH 0
+#define FILTER_REJECT 1
+#define FILTER_FIELDS 2
+#define FILTER_HEAD 3
+
+
+// a stage of a fused pipeline: grep [-F] [-v] pattern, cut -f list [-d c] [-s] or
+// head [-n count]. Field ranges are 1-based and inclusive. passed counts the lines the
+// stage has let through.
+typedef struct _textFilter{
+    int kind;
+    const char *pattern;
+    size_t patternLength;
+    long fieldFrom[MAX_FIELD_RANGES];
+    long fieldTo[MAX_FIELD_RANGES];
+    int numRanges;
+    char delimiter;
+    int onlyDelimited;
+    long limit;
+    long passed;
+} text_filter_t;
+
+
+// kinds of schedule
+#define SCHEDULE_FREE 0
+#define SCHEDULE_EVERY 1
+#define SCHEDULE_AT 2
+
+// schedule options
+#define SCHEDULE_SKIP_RUNNING 0x01
+
+
+// a command line run periodically by the every and at builtins. Times are in ticks of the
+// timer wheel: nominal is when the next run is due, due adds its jitter. Schedules in the
+// same wheel slot are linked through next and prev.
+typedef struct _schedule{
+    int kind;
+    int flags;
+    uint64_t interval;
+    uint64_t jitter;
+    int secondOfDay;
+    uint64_t nominal;
+    uint64_t due;
+    int slot;
+    int next, prev;
+    int running;
+    long runs, skipped, missed;
+    int lastStatus;
+    char command[MAX_SCHEDULE_LEN];
+} schedule_t;
+
+
+// a run of a schedule that has not been reaped yet; schedule is -1 once it was removed
+typedef struct _scheduleRun{
+    pid_t pid;
+    int schedule;
+} schedule_run_t;
+
+
+// kinds of delay a process can spend waiting instead of running
+#define DELAY_RUN_QUEUE 0
+#define DELAY_BLOCK_IO 1
+#define DELAY_SWAP_IN 2
+#define DELAY_RECLAIM 3
+#define NUM_DELAYS 4
+
+
+// delays of the children waited for, in nanoseconds; a kind that could not be read for
+// some child is marked unknown from then on
+typedef struct _delays{
+    uint64_t nanos[NUM_DELAYS];
+    uint32_t unknown;
+} delays_t;
 
 
+// a finished span waiting in the batch to be exported; ids are kept as hex text
+typedef struct _span{
+    char spanId[17];
+    char parentId[17];
+    char name[MAX_SPAN_NAME_LEN];
+    uint64_t startNanos;
+    uint64_t endNanos;
+    int exitStatus;
+    delays_t delays;
+    long cpuMicros;
+    long maxRssKb;
+    uint64_t submittedNanos;
+} span_t;
+
+
+extern char **environ;
+
+line_arena_t lineArena = {0, 0, 0, 0};
+
+write_options_t writeOptions[MAX_WRITE_OPTIONS];
+int numWriteOptions = 0;
+
+config_t *activeConfig = 0;
+config_t *retiredConfig = 0;
+char **baseEnviron = 0;
+volatile sig_atomic_t reloadRequested = 0;
+
+array_t arrays[MAX_ARRAYS];
+
+pattern_t patternCache[PATTERN_CACHE_SIZE];
+
+job_t jobs[MAX_JOBS];
+pid_t shellPid = 0;
+int defaultJobSlots = 1;
+unsigned long jobSequence = 0;
+long jobsStarted = 0, jobsRejected = 0;
+long jobWaitTotalMicros = 0, jobWaitMaxMicros = 0;
+long forkRetries = 0, forkFailures = 0;
+
+warm_child_t warmPool[MAX_WARM_CHILDREN];
+int numWarmChildren = 0;
+long warmDispatches = 0, warmForks = 0;
+
+schedule_t schedules[MAX_SCHEDULES];
+int numSchedules = 0;
+int wheel[WHEEL_LEVELS * WHEEL_SLOTS];
+uint64_t wheelTick = 0;
+struct timespec wheelStart;
+int timerFd = -1;
+pid_t scheduleOwner = 0;
+schedule_run_t scheduleRuns[MAX_SCHEDULE_RUNS];
+volatile int numScheduleRuns = 0;
+
+long childWaitMicros = 0;
+long childCpuMicros = 0, childMaxRssKb = 0;
+uint64_t jobSubmittedNanos = 0;
+long linesRun = 0;
+long overheadTotalMicros = 0, overheadMaxMicros = 0, parseTotalMicros = 0, childTotalMicros = 0;
+char overheadEnv[] = "MS_OVERHEAD_US=-9223372036854775808";
+
+delays_t *childDelays = 0;
+int collectingDelays = 0;
+int delayAccountingOn = 0;
+int taskstatsFd = -1;
+pid_t taskstatsOwner = 0;
+uint16_t taskstatsFamily = 0;
+
+int traceFd = -1;
+int traceIsSocket = 0;
+char traceId[33];
+char traceParentSpan[17];
+char traceFlags[3] = "01";
+char childTraceParent[] = "TRACEPARENT=00-00000000000000000000000000000000-0000000000000000-01";
+span_t spanBatch[SPAN_BATCH_LEN];
+int numSpans = 0;
+pid_t spanOwner = 0;
+
+int inputsTraced = 0;
+
+
+/*
+ Building with -DCHECK_ALLOCATIONS replaces the heap functions to enforce that, once the
+ first line has run, executing lines performs no heap allocation in the shell process.
+ Forked children may allocate freely. Code that legitimately allocates outside the warm
+ up, such as a configuration reload, is bracketed with ALLOW_ALLOCATIONS(1) and (0).
+ */
+#ifdef CHECK_ALLOCATIONS
+int allocationsAllowed = 1;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+#define ALLOW_ALLOCATIONS(allow) (allocationsAllowed += (allow) ? 1 : -1)
+
+void checkAllocation(const char *function){
+    
+    if(allocationsAllowed <= 0 && getpid() == shellPid){
+        write(fileno(stderr), "Error! Heap ", 12);
+        write(fileno(stderr), function, strlen(function));
+        write(fileno(stderr), " in the shell's steady state.\n", 30);
+        abort();
+    }
+}
+
+void *malloc(size_t size){ checkAllocation("malloc"); return __libc_malloc(size); }
+void *calloc(size_t count, size_t size){ checkAllocation("calloc"); return __libc_calloc(count, size); }
+void *realloc(void *ptr, size_t size){ checkAllocation("realloc"); return __libc_realloc(ptr, size); }
+void free(void *ptr){ if(ptr){ checkAllocation("free"); } __libc_free(ptr); }
+#else
+#define ALLOW_ALLOCATIONS(allow)
+#endif
+
+
+
+
+int runLines(FILE *input, int prompt);
+int runScript(const char *path, arg_t *argList);
+int startInit(void);
+int runNestedScript(const char *path, arg_t *argList);
+void startNestedShell(void);
+int resolveCommand(const char *name, char *path);
 int processArgs(const char *input, int *argChars, char *argBuffer, int *argCount, arg_t *argList, int *stopReason);
 int buildCommandChains(const char *input, char *argBuffer, arg_t *argList, command_t *chains);
+int parseWriteOptions(const char *input, write_options_t *options, int *length);
+off_t parseSize(const char *text, const char **end);
+int reserveLineArena(size_t inputLength);
 int executeCommandChain(const command_t *chain, int *commandCount);
 int executeSingleCommand(const command_t *command);
 int executePipedCommands(const command_t *left, const command_t *right);
+int fuseTextFilters(const command_t *first, text_filter_t *filters, const char **file);
+int parseTextFilter(arg_t *argList, text_filter_t *filter, const char **file);
+int parseFieldList(const char *list, text_filter_t *filter);
+int executeFusedFilters(const command_t *first, text_filter_t *filters, int count, const char *file);
+int scanTextFilters(const command_t *first, text_filter_t *filters, int count, const char *file, int fdIn, int fdOut);
+int runFilterPrograms(const command_t *first, text_filter_t *filters, int count, const char *file, int consumed,
+                      const char *pending, size_t pendingLength, int fdIn, int fdOut);
+const write_options_t *findWriteOptions(int fd);
+int runWithWriteback(const command_t *command, const write_options_t *options);
+int executeParallelMap(const command_t *command);
+int splitAtDelimiters(int fd, off_t size, char delimiter, int chunks, off_t *chunkStart);
+int executeRemoteMap(const command_t *command, arg_t *argList, char delimiter, const char *workerList);
+void loseWorker(worker_t *worker, int *retryTask, char (*retryHost)[MAX_HOST_LEN], int *numRetries,
+                int *taskState, int *taskAttempts, int *alive);
+int sendRemoteTask(worker_t *worker, arg_t *argList, int fdIn, off_t start, off_t end);
+int connectWorker(const worker_t *worker);
+int sendFrame(int fd, char type, const char *data, size_t length);
+int readFrame(int fd, char *type, char *data, size_t *length);
+int readAll(int fd, char *data, size_t length);
+int runWorker(const char *address);
+int serveCoordinator(int fd);
+int executeReplicatedCommand(const command_t *command);
+int executePartitionedCommand(const command_t *command);
+unsigned long hashLineField(const char *line, size_t length, int field);
+int openScratchFile(void);
+int copyFileContents(int fdFrom, int fdTo);
+int writeAll(int fd, const char *data, size_t length);
+int writeFormatted(int fd, const char *format, ...);
+pid_t forkCommand(void);
+pid_t waitForChild(pid_t pid, int *status);
+void fillWarmPool(void);
+void releaseWarmPool(void);
+pid_t dispatchWarmChild(const command_t *command);
+int packString(char *buffer, size_t *length, const char *text);
+void parkWarmChild(int controlFd);
+long microsSince(const struct timespec *start);
+void accountLine(const struct timespec *lineStart, long parseMicros);
+int showOverhead(int fdOut);
+int enableDelayAccounting(void);
+void readChildDelays(pid_t pid, delays_t *delays);
+int queryTaskstats(pid_t pid, struct taskstats *stats);
+int requestGenetlink(uint16_t family, uint8_t command, uint16_t attribute, const void *data, int length, char *reply);
+const struct nlattr *findAttribute(const char *start, int length, int type);
+int executeTimedCommand(const command_t *command);
+void execCommand(arg_t *argList);
+const arg_t *findAlias(const char *name);
+config_t *loadConfig(const char *path);
+void freeConfig(config_t *config);
+int reloadConfig(void);
+void requestReload(int sig);
+void applyPendingReload(void);
+int submitBackgroundJob(const command_t *chain, int *commandCount);
+void startQueuedJobs(void);
+void reapBackgroundJobs(int sig);
+void reportFinishedJobs(void);
+int listJobs(int fdOut);
+void getJobLimits(int *slots, int *queue);
+int defineSchedule(arg_t *argList, int kind, int fdOut);
+long parseDuration(const char *text);
+int listSchedules(int kind, int fdOut);
+void removeSchedule(int index);
+int startTimerWheel(void);
+uint64_t currentTick(void);
+uint64_t nextDailyTick(int secondOfDay);
+void insertSchedule(int index);
+void unlinkSchedule(int index);
+void advanceTimerWheel(void);
+void runSchedule(int index, uint64_t now);
+int startScheduleRun(int index);
+void waitForInput(FILE *input, int interactive);
+void serveSchedules(void);
+array_t *findArray(const char *name, int create);
+void clearArray(array_t *array);
+int defineArray(arg_t *argList, int type);
+int mapFileToArray(const command_t *command);
+const char *lookupArrayElement(const array_t *array, const char *subscript);
+arg_t *expandArrays(arg_t *argList);
+const char *resolveElementReference(const char *arg);
+int executeTest(arg_t *argList);
+const regex_t *compilePattern(const char *source, int isGlob);
+void initTracing(void);
+void beginSpan(span_t *span, const char *parentId, const char *prefix, const char *name);
+void endSpan(span_t *span, int exitStatus);
+void flushSpans(void);
+void randomHexId(char *id, int bytes);
+int executeCachedCommand(const command_t *command);
+int replayCacheEntry(const char *entryPath, const char *key, size_t keyLength, int fdOut);
+int storeCacheEntry(const char *entryPath, const char *key, size_t keyLength, char *inputs, size_t inputsLength, int outFile);
+int runTracedCommand(arg_t *argList, int fdIn, int fdOut, char **inputs, size_t *inputsLength, int *traced);
+int installInputTracer(int socket);
+int comparePaths(const void *a, const void *b);
+int addTracedInput(char **inputs, size_t *inputsLength, size_t *inputsCapacity, const char *base, const char *path);
 
 
 
 /*
  Main function. Displays a prompt and executes chains of commands entered by the user.
+ Run as microshell script [args...] it executes the lines of a script file instead, as
+ microshell -c line it executes that line, and as microshell --worker [host:]port it
+ serves pmap -w. A script or piped input that registered schedules keeps running them
+ after its last line. Any of these can be preceded by --init to run under a process
+ that stands in for init, as startInit describes.
  */
-int main(void){
+int main(int argc, char **argv){
     
-    char input[MAX_INPUT_LEN];
-    arg_t argList[MAX_INPUT_LEN];
-    char argBuffer[MAX_INPUT_LEN];
-    command_t commands[MAX_INPUT_LEN];
-    int numCommandChains, chainSkip, chainCount, commandCount;
+    static char outputBuffer[BUFSIZ];
+    struct sigaction reloadAction, childAction;
+    FILE *line;
     int exitStatus;
     
+    // only the main job returns; the init process exits with its status
+    if(argc > 1 && strcmp(argv[1], "--init") == 0){
+        if(startInit() < 0){
+            return 1;
+        }
+        argv[1] = argv[0];
+        --argc;
+        ++argv;
+    }
+    
+    // a static stdout buffer, so a script that first prints long after warm-up does not
+    // allocate one then
+    setvbuf(stdout, outputBuffer, isatty(fileno(stdout)) ? _IOLBF : _IOFBF, sizeof(outputBuffer));
+    
+    // SIGHUP rebuilds the configuration; reads resume so the current line is not lost
+    memset(&reloadAction, 0, sizeof(reloadAction));
+    reloadAction.sa_handler = requestReload;
+    reloadAction.sa_flags = SA_RESTART;
+    sigaction(SIGHUP, &reloadAction, 0);
+    
+    // SIGCHLD reaps background jobs and hands their slots to queued jobs
+    memset(&childAction, 0, sizeof(childAction));
+    childAction.sa_handler = reapBackgroundJobs;
+    childAction.sa_flags = SA_RESTART;
+    sigaction(SIGCHLD, &childAction, 0);
+    shellPid = getpid();
+    scheduleOwner = shellPid;
+    defaultJobSlots = sysconf(_SC_NPROCESSORS_ONLN);
+    
+    baseEnviron = environ;
+    reloadConfig();
+    if(argc == 3 && strcmp(argv[1], "--worker") == 0){
+        return runWorker(argv[2]);
+    }
+    initTracing();
+    fillWarmPool(); // a script finds the pool full, not only an interactive shell
+    
+    if(argc == 3 && strcmp(argv[1], "-c") == 0){
+        line = fmemopen(argv[2], strlen(argv[2]), "r");
+        exitStatus = line ? runLines(line, 0) : 1;
+    }
+    else if(argc > 1){
+        exitStatus = runScript(argv[1], argv+1);
+    }
+    else{
+        exitStatus = runLines(stdin, 1);
+    }
+    
+    if(argc > 1 || !isatty(fileno(stdin))){
+        serveSchedules();
+    }
+    return exitStatus;
+}
+
+
+
+
+/*
+ Reads lines from input until end of file and executes the chains of commands on each,
+ showing a prompt before every line if prompt is set. Lines starting with '#' are
+ comments. Returns the exit status of the last chain executed.
+ */
+int runLines(FILE *input, int prompt){
+    
+    char *line = 0;
+    size_t lineCapacity = 0;
+    ssize_t inputLength;
+    int numCommandChains, chainSkip, chainCount, commandCount;
+    int exitStatus = 0;
+    const command_t *last;
+    int warmedUp = 0;
+    struct timespec lineStart;
+    long parseMicros;
+    
     while(1){
-        memset(input, 0, MAX_INPUT_LEN);
-        memset(argList, 0, MAX_INPUT_LEN * sizeof(arg_t));
-        memset(argBuffer, 0, MAX_INPUT_LEN);
-        memset(commands, 0, MAX_INPUT_LEN * sizeof(command_t));
+        reportFinishedJobs();
+        if(isatty(fileno(input))){
+            flushSpans(); // an interactive shell exports its spans before waiting for input
+            fillWarmPool(); // and replaces the warm children the last line used
+        }
+        if(prompt){
+            if(linesRun && getenv("MS_OVERHEAD_PROMPT")){
+                printf("[%s us] ", overheadEnv+15);
+            }
+            printf(">> ");
+            fflush(stdout); // forked children must not inherit a pending prompt
+        }
+        waitForInput(input, prompt); // schedules and reloads run while the shell waits for the line
         
+        // the line and its arena only allocate when a line is longer than any before it
+        ALLOW_ALLOCATIONS(1);
+        inputLength = getline(&line, &lineCapacity, input);
+        if(inputLength < 0){
+            flushSpans();
+            break; // end of input
+        }
+        PROBE1(line__read, inputLength);
+        clock_gettime(CLOCK_MONOTONIC, &lineStart);
+        childWaitMicros = 0;
+        if(!reserveLineArena(inputLength)){
+            fprintf(stderr, "Error! Not enough memory for a line of %ld characters.\n", (long)inputLength);
+            ALLOW_ALLOCATIONS(0);
+            continue;
+        }
         
-        printf(">> ");
-        fgets(input, MAX_INPUT_LEN, stdin);
+        // each line is an epoch: a snapshot replaced during the last line is no longer
+        // in use, and a pending reload is published before the new line runs
+        applyPendingReload();
+        ALLOW_ALLOCATIONS(0);
         
-        if(strlen(input) > 0){
+        if(inputLength > 0 && line[strspn(line, " \t")] != '#'){
             
-            numCommandChains = buildCommandChains(input, argBuffer, argList, commands);
+            numCommandChains = buildCommandChains(line, lineArena.argBuffer, lineArena.argList, lineArena.commands);
+            parseMicros = microsSince(&lineStart);
             commandCount = 0;
             for (chainCount=0; chainCount < numCommandChains; ++chainCount){
-                exitStatus = executeCommandChain(commands+commandCount, &chainSkip);
+                for(last=lineArena.commands+commandCount; NEXT_COMMAND(last); last=NEXT_COMMAND(last));
+                
+                if(last->flags & CMD_BACKGROUND){
+                    exitStatus = submitBackgroundJob(lineArena.commands+commandCount, &chainSkip);
+                }
+                else{
+                    exitStatus = executeCommandChain(lineArena.commands+commandCount, &chainSkip);
+                }
                 commandCount += chainSkip;
             }
+            accountLine(&lineStart, parseMicros);
+            
+            if(!warmedUp){
+                warmedUp = 1;
+                ALLOW_ALLOCATIONS(0); // the first line sets up stdio buffers
+            }
+        }
+    }
+    
+    free(line);
+    ALLOW_ALLOCATIONS(0);
+    return exitStatus;
+}
+
+
+
+
+/*
+ Runs the script at path, making its name and arguments in argList available as the
+ indexed array argv. Returns the exit status of the script's last chain, or 127 if it
+ could not be opened.
+ */
+int runScript(const char *path, arg_t *argList){
+    
+    FILE *script;
+    arg_t *scriptArgs;
+    int count, exitStatus;
+    
+    
+    script = fopen(path, "re");
+    if(!script){
+        fprintf(stderr, "Error! Could not open script '%s'.\n", path);
+        return 127;
+    }
+    
+    for(count=0; argList[count]; ++count);
+    scriptArgs = malloc((count+2) * sizeof(arg_t));
+    scriptArgs[0] = "argv";
+    memcpy(scriptArgs+1, argList, (count+1) * sizeof(arg_t));
+    defineArray(scriptArgs, ARRAY_INDEXED);
+    free(scriptArgs);
+    
+    exitStatus = runLines(script, 0);
+    ALLOW_ALLOCATIONS(1);
+    fclose(script);
+    ALLOW_ALLOCATIONS(0);
+    return exitStatus;
+}
+
+
+
+
+/*
+ Makes the shell fit to run as PID 1 of a container. The process forks: the child becomes
+ the main job, in a process group of its own that owns the terminal if there is one, and
+ returns to run the shell as usual. The parent stays behind as init. It reaps every
+ process that ends up as its child, including orphans it adopted, and forwards the
+ signals it receives to the main job's process group, since the kernel drops signals
+ sent to PID 1 that it does not handle. Once the main job is gone it exits with the main
+ job's exit status, or 128 plus the signal that killed it. Outside PID 1 it registers as
+ a subreaper, so orphans are still reaped. Returns 0 in the main job, or -1 if it could
+ not be started.
+ */
+int startInit(void){
+    
+    // signals raised by a fault in the init process itself are left alone
+    static const int ownSignals[] = {SIGFPE, SIGILL, SIGSEGV, SIGBUS, SIGABRT, SIGTRAP, SIGSYS, SIGTTIN, SIGTTOU};
+    sigset_t waited, oldMask;
+    siginfo_t info;
+    pid_t pid, reaped;
+    int status = 0, sig, i;
+    
+    
+    sigfillset(&waited);
+    for(i=0; i < (int)(sizeof(ownSignals) / sizeof(ownSignals[0])); ++i){
+        sigdelset(&waited, ownSignals[i]);
+    }
+    sigprocmask(SIG_BLOCK, &waited, &oldMask);
+    if(getpid() != 1){
+        prctl(PR_SET_CHILD_SUBREAPER, 1);
+    }
+    
+    pid = fork();
+    if(pid < 0){
+        sigprocmask(SIG_SETMASK, &oldMask, 0);
+        fprintf(stderr, "Error! Could not fork the main job: %s.\n", strerror(errno));
+        return -1;
+    }
+    if(pid == 0){
+        // SIGTTOU is still blocked, so taking the terminal cannot stop the job
+        setpgid(0, 0);
+        if(isatty(fileno(stdin))){
+            tcsetpgrp(fileno(stdin), getpid());
+        }
+        sigprocmask(SIG_SETMASK, &oldMask, 0);
+        return 0;
+    }
+    setpgid(pid, pid);
+    
+    while(1){
+        while((sig = sigwaitinfo(&waited, &info)) < 0 && errno == EINTR);
+        if(sig == SIGCHLD){
+            while((reaped = waitpid(-1, &status, WNOHANG)) > 0){
+                if(reaped == pid){
+                    exit(WIFEXITED(status) ? WEXITSTATUS(status) : 128+WTERMSIG(status));
+                }
+            }
+        }
+        else if(sig > 0 && kill(-pid, sig) < 0){
+            kill(pid, sig); // the main job has left its group
         }
     }
-    return 0;
 }
 
 
@@ -123,15 +896,19 @@ int processArgs(const char *input, int *argChars, char *argBuffer, int *argCount
     char quoteChar = 0;
     int processed = 0;
     const char *c = input;
-    char curArg[MAX_INPUT_LEN];
     int curArgLen = 0;
     int argsOffset = 0;
     
-    memset(curArg, 0, MAX_INPUT_LEN);
     *argCount = 0;
+    PROBE1(args__start, input);
     
     while(1){
         if(*c == 0){
+            if(curArgLen > 0){ // input ended without a newline
+                argBuffer[argsOffset+curArgLen] = 0;
+                argList[(*argCount)++] = (argBuffer+argsOffset);
+                argsOffset += (curArgLen + 1);
+            }
             *stopReason = SR_DONE;
             break;
         }
@@ -154,10 +931,9 @@ int processArgs(const char *input, int *argChars, char *argBuffer, int *argCount
         else if((ISWHITESPACE(*c) || ISCONTROLCHAR(*c)) && !(escaped || quoted)){
                     
             if(curArgLen > 0){
-                memcpy((argBuffer+argsOffset), curArg, curArgLen);
+                argBuffer[argsOffset+curArgLen] = 0;
                 argList[(*argCount)++] = (argBuffer+argsOffset);
                 argsOffset += (curArgLen + 1);
-                memset(curArg, 0, curArgLen);
                 curArgLen = 0;
                 
                 while(ISWHITESPACE(*c)){
@@ -217,7 +993,7 @@ int processArgs(const char *input, int *argChars, char *argBuffer, int *argCount
             
         } 
         else{
-            curArg[curArgLen++] = *c;
+            argBuffer[argsOffset+curArgLen++] = *c;
             escaped = 0;
         }
         
@@ -227,6 +1003,8 @@ int processArgs(const char *input, int *argChars, char *argBuffer, int *argCount
     
     ++processed; // count character that broke the loop
     *argChars = argsOffset;
+    argList[*argCount] = 0;
+    PROBE2(args__end, *argCount, *stopReason);
     
     return processed;
 }
@@ -249,12 +1027,20 @@ int buildCommandChains(const char *input, char *argBuffer, arg_t *argList, comma
     int chainCount = 0;
     int commandCount = 0;
     int continueLast = 0;
+    int replicas = 1;
+    int partitionField = NO_PARTITION;
+    int digits, fieldDigits;
     int *getFd = 0;
     int oflags = 0;
     arg_t filename;
     command_t *com, *lastCom = 0;
+    write_options_t options;
+    int wantOptions = 0;
+    struct stat fileStat;
     
     
+    PROBE1(parse__start, input);
+    numWriteOptions = 0;
     do{
         if(getFd){ // the user wants to open a file for redirection
             inputPos += processArgs(input+inputPos, &argChars, argBuffer+argCharsTotal,
@@ -262,6 +1048,7 @@ int buildCommandChains(const char *input, char *argBuffer, arg_t *argList, comma
             
             if(stopReason == SR_ERROR || argCount != 1){
                 fprintf(stderr, "Error reading filename for redirect.\n");
+                wantOptions = 0;
                 continue;
             }
             
@@ -269,12 +1056,31 @@ int buildCommandChains(const char *input, char *argBuffer, arg_t *argList, comma
             argCharsTotal += argChars;
             argTotal += argCount+1;
             
+            // without a size hint, a truncated file is expected to grow back to the size
+            // its previous contents had
+            if(wantOptions && options.prealloc < 0){
+                options.prealloc = (oflags & O_TRUNC) && stat(filename, &fileStat) == 0 &&
+                                   S_ISREG(fileStat.st_mode) ? fileStat.st_size : 0;
+            }
+            
             *getFd = open(filename, oflags, S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | S_IROTH);
             if(*getFd < 0){
                 fprintf(stderr, "Error opening file '%s' for redirect.\n", filename);
+                wantOptions = 0;
                 continue;
             }
             lseek(*getFd, 0, SEEK_SET);
+            
+            if(wantOptions){
+                if(numWriteOptions < MAX_WRITE_OPTIONS){
+                    options.fd = *getFd;
+                    writeOptions[numWriteOptions++] = options;
+                }
+                else{
+                    fprintf(stderr, "Error! Too many redirects with options on one line.\n");
+                }
+                wantOptions = 0;
+            }
             getFd = 0;
         }
         
@@ -293,18 +1099,19 @@ int buildCommandChains(const char *input, char *argBuffer, arg_t *argList, comma
                 }
                 
                 com = chains+commandCount++;
-                com->argList = argList+argTotal;
-                com->stopOnFailure = 0;
-                com->stopOnSuccess = 0;
-                com->background = 0;
-                com->piped = 0;
-                com->next = 0;
+                com->argIndex = argTotal;
+                com->flags = 0;
+                com->replicas = replicas;
+                com->partitionField = partitionField;
+                com->next = NO_COMMAND;
                 com->fdIn = fileno(stdin);
                 com->fdOut = fileno(stdout);
                 
                 if(lastCom){
-                    lastCom->next = com;
+                    lastCom->next = com-chains;
                 }
+                replicas = 1;
+                partitionField = NO_PARTITION;
             }
             
             argCharsTotal += argChars;
@@ -314,19 +1121,42 @@ int buildCommandChains(const char *input, char *argBuffer, arg_t *argList, comma
         
         switch(stopReason){
             case SR_SEQ_AND:
-                com->stopOnFailure = 1;
+                com->flags |= CMD_STOP_ON_FAILURE;
                 lastCom = com;
                 break;
                 
             case SR_SEQ_OR:
-                com->stopOnSuccess = 1;
+                com->flags |= CMD_STOP_ON_SUCCESS;
                 lastCom = com;
                 break;
                 
             case SR_PIPE:
-                com->piped = 1;
-                com->stopOnFailure = 1;
+                com->flags |= CMD_PIPED | CMD_STOP_ON_FAILURE;
                 lastCom = com;
+                
+                // a pipe written as |N| runs N replicas of the next command, and one
+                // written as |N:F| routes each line to a replica by the hash of field F
+                for(digits=0; input[inputPos+digits] >= '0' && input[inputPos+digits] <= '9'; ++digits);
+                fieldDigits = 0;
+                if(digits > 0 && input[inputPos+digits] == ':'){
+                    while(input[inputPos+digits+1+fieldDigits] >= '0' && input[inputPos+digits+1+fieldDigits] <= '9'){
+                        ++fieldDigits;
+                    }
+                    if(fieldDigits > 0 && input[inputPos+digits+1+fieldDigits] == '|'){
+                        partitionField = atoi(input+inputPos+digits+1);
+                        digits += fieldDigits+1;
+                    }
+                }
+                if(digits > 0 && input[inputPos+digits] == '|'){
+                    replicas = atoi(input+inputPos);
+                    inputPos += digits+1;
+                }
+                if(replicas > MAX_PARALLEL_JOBS){
+                    replicas = MAX_PARALLEL_JOBS;
+                }
+                if(partitionField > INT16_MAX){
+                    partitionField = INT16_MAX;
+                }
                 break;
                 
             case SR_REDIRECT_IN:
@@ -335,18 +1165,24 @@ int buildCommandChains(const char *input, char *argBuffer, arg_t *argList, comma
                 break;
                 
             case SR_REDIRECT_OUT:
-                getFd = &(com->fdOut);
-                oflags = O_WRONLY | O_CREAT | O_TRUNC;
-                break;
-                
             case SR_REDIRECT_OUT_APPEND:
                 getFd = &(com->fdOut);
-                oflags = O_WRONLY | O_CREAT | O_APPEND;
+                oflags = O_WRONLY | O_CREAT | (stopReason == SR_REDIRECT_OUT ? O_TRUNC : O_APPEND);
+                
+                // a redirect written as >{options} file controls how the file is written
+                if(input[inputPos] == '{'){
+                    wantOptions = parseWriteOptions(input+inputPos, &options, &digits);
+                    if(!wantOptions){
+                        fprintf(stderr, "Error! Unrecognized redirect options '%.*s'.\n", digits, input+inputPos);
+                    }
+                    inputPos += digits;
+                }
                 break;
                 
             case SR_BACKGROUND:
-                continueLast = 1;
-                com->background = 1;
+                com->flags |= CMD_BACKGROUND;
+                ++chainCount;
+                lastCom = 0;
                 break;
                 
             case SR_SEQ_CHAIN:
@@ -358,6 +1194,7 @@ int buildCommandChains(const char *input, char *argBuffer, arg_t *argList, comma
     } while(stopReason != SR_DONE);
     
     
+    PROBE2(parse__end, chainCount, commandCount);
     return chainCount;
 }
 
@@ -365,107 +1202,309 @@ int buildCommandChains(const char *input, char *argBuffer, arg_t *argList, comma
 
 
 /*
- Executes a single command chain starting with the first command in *chain. The
- parameter *commandCount returns the total number of commands in the chain, regardless
- of whether all commands were successfully executed.
+ Parses the options of a redirect written as >{options} file from input, which starts
+ at the '{'. Options are separated by commas:
+ 
+   prealloc[=size]  reserves size bytes for the output up front, or as many bytes as the
+                    file held before it was truncated
+   sync=stride      starts write-back every stride bytes and waits for the stride before
+                    it to be written, so at most two strides are dirty
+   dontneed         drops written pages from the page cache once they are on disk
+ 
+ Sizes take a K, M or G suffix. Returns 1 if every option was recognized, 0 otherwise.
+ 
+ Return parameters:
+ *options - the options, with prealloc set to -1 if the size is to be estimated
+ *length - the number of characters taken from input, including the braces
  */
-int executeCommandChain(const command_t *chain, int *commandCount){
+int parseWriteOptions(const char *input, write_options_t *options, int *length){
     
-    int status, allStatus;
-    int stopped = 0;
+    const char *c = input+1;
+    const char *end;
+    int valid = 1;
     
-    *commandCount = 0;
     
-    while(chain){
-        
-        if(!stopped){
-            
-            if(chain->piped){
-                status = executePipedCommands(chain, chain->next);
-                if(!commandCount){
-                    allStatus = status;
-                }
-                
-                while(chain->piped){
-                    ++(*commandCount);
-                    chain = chain->next;
-                }
-            }
-            else{
-                status = executeSingleCommand(chain);
-                if(!commandCount){
-                    allStatus = status;
-                }
-            }
-            
-            if(chain->stopOnFailure){
-                allStatus += abs(status); // if any has nonzero exit status, total status is nonzero
-                stopped = status;
-            }
-            else if(chain->stopOnSuccess){
-                allStatus *= status; // if any has zero exit status, total is zero
-                stopped = !status;
-            }
-            else{
-                allStatus += status;
-            }
+    memset(options, 0, sizeof(*options));
+    while(*c && *c != '}' && *c != '\n'){
+        if(strncmp(c, "prealloc", 8) == 0 && (c[8] == ',' || c[8] == '}')){
+            options->prealloc = -1;
+            c += 8;
+        }
+        else if(strncmp(c, "prealloc=", 9) == 0){
+            options->prealloc = parseSize(c+9, &end);
+            valid &= end > c+9;
+            c = end;
+        }
+        else if(strncmp(c, "sync=", 5) == 0){
+            options->syncStride = parseSize(c+5, &end);
+            valid &= end > c+5;
+            c = end;
+        }
+        else if(strncmp(c, "dontneed", 8) == 0){
+            options->dropCache = 1;
+            c += 8;
+        }
+        else{
+            valid = 0;
         }
         
-        ++(*commandCount);
-        chain = chain->next;
+        if(*c == ','){
+            ++c;
+        }
+        else if(*c != '}'){
+            valid = 0;
+            c += strcspn(c, ",}\n");
+            c += (*c == ',');
+        }
     }
     
-    return allStatus;
+    valid &= (*c == '}');
+    c += (*c == '}');
+    *length = c-input;
+    return valid;
 }
 
 
 
 
 /*
- Forks the current process to execute the specified command. Returns the exit status
- of the command, or 1 if it does not finish executing.
+ Parses a byte count with an optional K, M or G suffix from text and returns it.
+ 
+ Return parameters:
+ *end - the first character after the size, or text if there was no number
  */
-int executeSingleCommand(const command_t *command){
+off_t parseSize(const char *text, const char **end){
     
-    int exitStatus;
-    pid_t pid;
+    char *suffix;
+    off_t size = strtoull(text, &suffix, 10);
     
     
-    // if exit command just exit the current process without forking
-    if(strcmp(command->argList[0], "exit") == 0){
-        exit(0);
+    if(suffix == text || *text < '0' || *text > '9'){
+        *end = text;
         return 0;
     }
+    switch(*suffix){
+        case 'G': size <<= 10; // fall through
+        case 'M': size <<= 10; // fall through
+        case 'K': size <<= 10; ++suffix;
+    }
+    *end = suffix;
+    return size;
+}
+
+
+
+
+/*
+ Makes sure the line arena can hold everything parsed from a line of inputLength
+ characters: every argument and command needs at least one input character, so each
+ buffer is bounded by the line length. Returns 0 if the arena could not be grown.
+ */
+int reserveLineArena(size_t inputLength){
     
-    pid = fork();
+    size_t capacity = lineArena.capacity ? lineArena.capacity : 256;
+    char *argBuffer;
+    arg_t *argList;
+    command_t *commands;
     
-    if(pid < 0){
-        fprintf(stderr, "Error! Could not fork process for command '%s'.\n", command->argList[0]);
-        exit(1);
+    if(inputLength <= lineArena.capacity){
+        return 1;
     }
-    else if(pid == 0){
-        
-        dup2(command->fdIn, fileno(stdin));
-        dup2(command->fdOut, fileno(stdout));
-        
-        execvp(command->argList[0], command->argList);
+    while(capacity < inputLength){
+        capacity *= 2;
+    }
+    
+    argBuffer = realloc(lineArena.argBuffer, 2*capacity+2);
+    if(argBuffer){
+        lineArena.argBuffer = argBuffer;
+    }
+    argList = realloc(lineArena.argList, (2*capacity+2) * sizeof(arg_t));
+    if(argList){
+        lineArena.argList = argList;
+    }
+    commands = realloc(lineArena.commands, (capacity+1) * sizeof(command_t));
+    if(commands){
+        lineArena.commands = commands;
+    }
+    
+    if(!(argBuffer && argList && commands)){
+        return 0;
+    }
+    lineArena.capacity = capacity;
+    return 1;
+}
+
+
+
+
+/*
+ Executes a single command chain starting with the first command in *chain. The
+ parameter *commandCount returns the total number of commands in the chain, regardless
+ of whether all commands were successfully executed. Each command's status is combined
+ with the chain's status by the connector before it: after && the chain fails if either
+ failed, and after || it succeeds if either succeeded.
+ */
+int executeCommandChain(const command_t *chain, int *commandCount){
+    
+    int status, allStatus = 0;
+    int stopped = 0, connector = 0;
+    span_t chainSpan, commandSpan;
+    
+    *commandCount = 0;
+    beginSpan(&chainSpan, traceParentSpan, "chain: ", COMMAND_ARGS(chain)[0]);
+    chainSpan.submittedNanos = jobSubmittedNanos; // set when this is a background job
+    jobSubmittedNanos = 0;
+    
+    while(chain){
         
-        // show an error if the command was not successfully exec'd
-        fprintf(stderr, "Error! The command '%s' could not be found.\n", command->argList[0]);
-        exit(1);
+        if(!stopped){
+            
+            // every stage of a pipeline is spawned under the pipeline's span
+            if(chain->flags & CMD_PIPED){
+                beginSpan(&commandSpan, chainSpan.spanId, "pipeline: ", COMMAND_ARGS(chain)[0]);
+                status = executePipedCommands(chain, NEXT_COMMAND(chain));
+                endSpan(&commandSpan, status);
+                
+                while(chain->flags & CMD_PIPED){
+                    ++(*commandCount);
+                    chain = NEXT_COMMAND(chain);
+                }
+            }
+            else{
+                beginSpan(&commandSpan, chainSpan.spanId, "", COMMAND_ARGS(chain)[0]);
+                status = executeSingleCommand(chain);
+                endSpan(&commandSpan, status);
+            }
+            
+            if(connector & CMD_STOP_ON_FAILURE){
+                allStatus += abs(status); // if any has nonzero exit status, total status is nonzero
+            }
+            else if(connector & CMD_STOP_ON_SUCCESS){
+                allStatus *= status; // if any has zero exit status, total is zero
+            }
+            else{
+                allStatus = status; // the first command of the chain
+            }
+            connector = chain->flags & (CMD_STOP_ON_FAILURE | CMD_STOP_ON_SUCCESS);
+            stopped = (connector & CMD_STOP_ON_FAILURE) ? status : (connector & CMD_STOP_ON_SUCCESS) && !status;
+        }
         
+        ++(*commandCount);
+        chain = NEXT_COMMAND(chain);
+    }
+    
+    endSpan(&chainSpan, allStatus);
+    return allStatus;
+}
+
+
+
+
+/*
+ Forks the current process to execute the specified command. Returns the exit status
+ of the command, or 1 if it does not finish executing.
+ */
+int executeSingleCommand(const command_t *command){
+    
+    int exitStatus;
+    pid_t pid;
+    
+    
+    // if exit command just exit the current process without forking
+    if(strcmp(COMMAND_ARGS(command)[0], "exit") == 0){
+        flushSpans();
+        exit(0);
+        return 0;
+    }
+    
+    // the timed command runs as a command of its own, which closes the redirects
+    if(strcmp(COMMAND_ARGS(command)[0], "time") == 0 && COMMAND_ARGS(command)[1]){
+        return executeTimedCommand(command);
+    }
+    
+    // replicated commands and the parallel map builtin run their own command instances
+    if(command->replicas > 1 && command->partitionField != NO_PARTITION){
+        exitStatus = executePartitionedCommand(command);
+    }
+    else if(command->replicas > 1){
+        exitStatus = executeReplicatedCommand(command);
+    }
+    else if(strcmp(COMMAND_ARGS(command)[0], "pmap") == 0){
+        exitStatus = executeParallelMap(command);
+    }
+    else if(strcmp(COMMAND_ARGS(command)[0], "reload") == 0){
+        ALLOW_ALLOCATIONS(1);
+        exitStatus = !reloadConfig();
+        ALLOW_ALLOCATIONS(0);
+    }
+    else if(strcmp(COMMAND_ARGS(command)[0], "jobs") == 0){
+        exitStatus = listJobs(command->fdOut);
+    }
+    else if(strcmp(COMMAND_ARGS(command)[0], "every") == 0 || strcmp(COMMAND_ARGS(command)[0], "at") == 0){
+        ALLOW_ALLOCATIONS(1); // the first at loads the time zone
+        exitStatus = defineSchedule(COMMAND_ARGS(command)+1,
+                                    COMMAND_ARGS(command)[0][0] == 'e' ? SCHEDULE_EVERY : SCHEDULE_AT,
+                                    command->fdOut);
+        ALLOW_ALLOCATIONS(0);
+    }
+    else if(strcmp(COMMAND_ARGS(command)[0], "overhead") == 0){
+        exitStatus = showOverhead(command->fdOut);
+    }
+    else if(strcmp(COMMAND_ARGS(command)[0], "cache") == 0){
+        ALLOW_ALLOCATIONS(1);
+        exitStatus = executeCachedCommand(command);
+        ALLOW_ALLOCATIONS(0);
+    }
+    else if(strcmp(COMMAND_ARGS(command)[0], "array") == 0 || strcmp(COMMAND_ARGS(command)[0], "assoc") == 0){
+        ALLOW_ALLOCATIONS(1);
+        exitStatus = defineArray(COMMAND_ARGS(command)+1,
+                                 COMMAND_ARGS(command)[0][1] == 'r' ? ARRAY_INDEXED : ARRAY_ASSOCIATIVE);
+        ALLOW_ALLOCATIONS(0);
+    }
+    else if(strcmp(COMMAND_ARGS(command)[0], "[[") == 0){
+        exitStatus = executeTest(COMMAND_ARGS(command));
+    }
+    else if(strcmp(COMMAND_ARGS(command)[0], "mapfile") == 0){
+        ALLOW_ALLOCATIONS(1);
+        exitStatus = mapFileToArray(command);
+        ALLOW_ALLOCATIONS(0);
     }
     else{
-        waitpid(pid, &exitStatus, 0);
+        PROBE1(spawn__begin, COMMAND_ARGS(command)[0]);
+        pid = dispatchWarmChild(command);
+        if(pid < 0){
+            pid = forkCommand();
+        }
         
-        if(command->fdIn != fileno(stdin)){
-            close(command->fdIn);
+        if(pid < 0){
+            fprintf(stderr, "Error! Could not fork process for command '%s': %s.\n",
+                    COMMAND_ARGS(command)[0], strerror(errno));
+            exitStatus = 1;
         }
-        if(command->fdOut != fileno(stdout)){
-            close(command->fdOut);
+        else{
+            if(pid == 0){
+                
+                if(command->fdOut != fileno(stdout) && findWriteOptions(command->fdOut)){
+                    _exit(runWithWriteback(command, findWriteOptions(command->fdOut)));
+                }
+                dup2(command->fdIn, fileno(stdin));
+                dup2(command->fdOut, fileno(stdout));
+                
+                execCommand(COMMAND_ARGS(command));
+            }
+            PROBE2(spawn__end, COMMAND_ARGS(command)[0], pid);
+            
+            waitForChild(pid, &exitStatus);
+            PROBE2(child__reaped, pid, exitStatus);
+            exitStatus = WEXITSTATUS(exitStatus);
         }
-        
-        exitStatus = WEXITSTATUS(exitStatus);
+    }
+    
+    if(command->fdIn != fileno(stdin)){
+        close(command->fdIn);
+    }
+    if(command->fdOut != fileno(stdout)){
+        close(command->fdOut);
     }
     
     return exitStatus;
@@ -481,49 +1520,68 @@ int executeSingleCommand(const command_t *command){
  */
 int executePipedCommands(const command_t *left, const command_t *right){
     
-    int exitStatus, childExitStatus;
+    static text_filter_t filters[MAX_FUSED_FILTERS];
+    const char *file;
+    int exitStatus, childExitStatus, count;
     int commandPipe[2];
     pid_t pidRight, pidLeft;
     
     
-    if(!(left->piped && right)){
+    if(!((left->flags & CMD_PIPED) && right)){
         // if this is the last command in the pipeline, run it and return
         return executeSingleCommand(left);
     }
     
+    // text filters from here to the end of the pipeline run as a single scan
+    if((count = fuseTextFilters(left, filters, &file)) > 0){
+        return executeFusedFilters(left, filters, count, file);
+    }
+    
     
-    pipe(commandPipe);
-    pidRight = fork(); // fork once to execute pipeline on right
+    if(pipe(commandPipe) < 0){
+        fprintf(stderr, "Error! Could not create pipe for command '%s': %s.\n", COMMAND_ARGS(left)[0], strerror(errno));
+        return 1;
+    }
+    PROBE2(pipe__created, commandPipe[0], commandPipe[1]);
+    pidRight = forkCommand(); // fork once to execute pipeline on right
     
     if(pidRight < 0){
-        fprintf(stderr, "Error! Could not fork process for command '%s'.\n", right->argList[0]);
-        exit(1);
+        fprintf(stderr, "Error! Could not fork process for command '%s': %s.\n", COMMAND_ARGS(right)[0], strerror(errno));
+        close(commandPipe[0]);
+        close(commandPipe[1]);
+        return 1;
     }
     else if(pidRight == 0){
         close(commandPipe[1]);
         dup2(commandPipe[0], right->fdIn);
-        exit(executePipedCommands(right, right->next));
+        _exit(executePipedCommands(right, NEXT_COMMAND(right)));
     }
     else{
-        pidLeft = fork(); // fork again to execute left command
+        pidLeft = forkCommand(); // fork again to execute left command
         
         if(pidLeft < 0){
-            fprintf(stderr, "Error! Could not fork process for command '%s'.\n", left->argList[0]);
-            exit(1);
+            // the right side sees end of input and finishes on its own
+            fprintf(stderr, "Error! Could not fork process for command '%s': %s.\n", COMMAND_ARGS(left)[0], strerror(errno));
+            close(commandPipe[0]);
+            close(commandPipe[1]);
+            waitForChild(pidRight, &childExitStatus);
+            return 1;
         }
         else if(pidLeft == 0){
             close(commandPipe[0]);
             dup2(commandPipe[1], left->fdOut);
-            exit(executeSingleCommand(left));
+            _exit(executeSingleCommand(left));
         }
         else{
             close(commandPipe[0]);
             close(commandPipe[1]);
             
-            waitpid(pidRight, &childExitStatus, 0);
+            waitForChild(pidRight, &childExitStatus);
+            PROBE2(child__reaped, pidRight, childExitStatus);
             childExitStatus = WEXITSTATUS(childExitStatus);
             
-            waitpid(pidLeft, &exitStatus, 0);
+            waitForChild(pidLeft, &exitStatus);
+            PROBE2(child__reaped, pidLeft, exitStatus);
             exitStatus = WEXITSTATUS(exitStatus);
             
             exitStatus += WEXITSTATUS(childExitStatus);
@@ -535,6 +1593,5234 @@ int executePipedCommands(const command_t *left, const command_t *right){
 
 
 
+/*
+ Checks whether the commands from first to the end of its pipeline are all text filters
+ the shell can run itself, and parses them into filters. Only the first stage may name
+ an input file, stored in *file, and only the first and last stages may be redirected.
+ Fusion stands in for whatever grep, cut and head PATH names, so it is off unless
+ MICROSHELL_FUSION=1 is set, and an alias for a filter's name turns it off again.
+ Returns the number of stages, or 0 if the pipeline is not fused.
+ */
+int fuseTextFilters(const command_t *first, text_filter_t *filters, const char **file){
+    
+    const command_t *com;
+    const char *setting = getenv("MICROSHELL_FUSION");
+    int count = 0;
+    
+    *file = 0;
+    if(!setting || strcmp(setting, "1") != 0){
+        return 0;
+    }
+    for(com=first; com; com=(com->flags & CMD_PIPED) ? NEXT_COMMAND(com) : 0, ++count){
+        if(count == MAX_FUSED_FILTERS || com->replicas > 1 || findAlias(COMMAND_ARGS(com)[0]) ||
+           (com != first && com->fdIn != fileno(stdin)) ||
+           ((com->flags & CMD_PIPED) && com->fdOut != fileno(stdout)) ||
+           !parseTextFilter(COMMAND_ARGS(com), filters+count, com == first ? file : 0)){
+            return 0;
+        }
+        if(!(com->flags & CMD_PIPED) && com->fdOut != fileno(stdout) && findWriteOptions(com->fdOut)){
+            return 0;
+        }
+    }
+    return count > 1 ? count : 0;
+}
+
+
+
+
+/*
+ Parses a command into a text filter if it is one of the forms the shell runs itself
+ with the same output as the program: grep with -F, -v and a single pattern (which must
+ be a fixed string), cut with -f, -d and -s, or head with -n or -count. A file to read is
+ only accepted if file is not 0. Returns 0 for any other command.
+ */
+int parseTextFilter(arg_t *argList, text_filter_t *filter, const char **file){
+    
+    int fixed = 0, i = 1;
+    const char *option;
+    char *end;
+    
+    memset(filter, 0, sizeof(*filter));
+    filter->delimiter = '\t';
+    
+    if(strcmp(argList[0], "grep") == 0){
+        filter->kind = FILTER_MATCH;
+        for(; argList[i] && argList[i][0] == '-' && argList[i][1]; ++i){
+            for(option=argList[i]+1; *option == 'F' || *option == 'v'; ++option){
+                fixed |= (*option == 'F');
+                filter->kind = *option == 'v' ? FILTER_REJECT : filter->kind;
+            }
+            if(*option){
+                return 0;
+            }
+        }
+        if(!argList[i] || strchr(argList[i], '\n') || (!fixed && strpbrk(argList[i], "\\.[*^$"))){
+            return 0;
+        }
+        filter->pattern = argList[i++];
+        filter->patternLength = strlen(filter->pattern);
+    }
+    else if(strcmp(argList[0], "cut") == 0){
+        filter->kind = FILTER_FIELDS;
+        for(; argList[i] && argList[i][0] == '-' && argList[i][1]; ++i){
+            option = argList[i][2] ? argList[i]+2 : argList[i+1];
+            if(strcmp(argList[i], "-s") == 0){
+                filter->onlyDelimited = 1;
+                continue;
+            }
+            if(!option){
+                return 0;
+            }
+            if(strncmp(argList[i], "-f", 2) == 0 && parseFieldList(option, filter)){
+                i += !argList[i][2];
+            }
+            else if(strncmp(argList[i], "-d", 2) == 0 && strlen(option) == 1){
+                filter->delimiter = option[0];
+                i += !argList[i][2];
+            }
+            else{
+                return 0;
+            }
+        }
+        if(!filter->numRanges){
+            return 0;
+        }
+    }
+    else if(strcmp(argList[0], "head") == 0){
+        filter->kind = FILTER_HEAD;
+        filter->limit = 10;
+        option = 0;
+        if(argList[i] && strcmp(argList[i], "-n") == 0){
+            if(!(option = argList[i+1])){
+                return 0;
+            }
+            i += 2;
+        }
+        else if(argList[i] && argList[i][0] == '-' && argList[i][1]){
+            option = argList[i] + (argList[i][1] == 'n' ? 2 : 1);
+            ++i;
+        }
+        if(option){
+            filter->limit = strtol(option, &end, 10);
+            if(*option < '0' || *option > '9' || *end){
+                return 0;
+            }
+        }
+    }
+    else{
+        return 0;
+    }
+    
+    if(argList[i] && file && argList[i][0] != '-' && !argList[i+1]){
+        *file = argList[i++];
+    }
+    return !argList[i];
+}
+
+
+
+
+/*
+ Parses the field list of cut -f: comma separated fields n, ranges n-m and open ranges
+ n- and -m. Returns 0 if the list is not valid.
+ */
+int parseFieldList(const char *list, text_filter_t *filter){
+    
+    const char *c = list;
+    char *end;
+    long from, to;
+    
+    while(*c){
+        if(filter->numRanges == MAX_FIELD_RANGES){
+            return 0;
+        }
+        from = *c == '-' ? 1 : strtol(c, &end, 10);
+        c = *c == '-' ? c : end;
+        to = from;
+        if(*c == '-'){
+            ++c;
+            to = (*c >= '0' && *c <= '9') ? strtol(c, &end, 10) : LONG_MAX;
+            c = to == LONG_MAX ? c : end;
+        }
+        if(from < 1 || to < from || (*c && *c != ',')){
+            return 0;
+        }
+        filter->fieldFrom[filter->numRanges] = from;
+        filter->fieldTo[filter->numRanges++] = to;
+        c += (*c == ',');
+    }
+    return filter->numRanges > 0;
+}
+
+
+
+
+/*
+ Runs a fused pipeline of text filters and closes its redirects. The shell forks one
+ process for the scan; a forked copy of the shell scans in place. Returns the status
+ executePipedCommands gets for the same pipeline unfused, which is that of its first
+ command: 1 if it is a grep that let no line through before its input ended, 0 if the
+ scan ran otherwise, and the status of the first command for an input file that could
+ not be opened (2 for grep, 1 for cut and head).
+ */
+int executeFusedFilters(const command_t *first, text_filter_t *filters, int count, const char *file){
+    
+    const command_t *last;
+    int fdIn = first->fdIn, exitStatus;
+    pid_t pid;
+    
+    
+    for(last=first; NEXT_COMMAND(last) && (last->flags & CMD_PIPED); last=NEXT_COMMAND(last));
+    if(file){
+        fdIn = open(file, O_RDONLY | O_CLOEXEC);
+        if(fdIn < 0){
+            fprintf(stderr, "Error! Could not open input file '%s': %s.\n", file, strerror(errno));
+        }
+    }
+    
+    if(fdIn < 0){
+        exitStatus = (filters[0].kind == FILTER_MATCH || filters[0].kind == FILTER_REJECT) ? 2 : 1;
+    }
+    else if(getpid() != shellPid){
+        exitStatus = scanTextFilters(first, filters, count, file, fdIn, last->fdOut);
+    }
+    else{
+        PROBE1(spawn__begin, COMMAND_ARGS(first)[0]);
+        pid = forkCommand();
+        if(pid < 0){
+            fprintf(stderr, "Error! Could not fork process for command '%s': %s.\n",
+                    COMMAND_ARGS(first)[0], strerror(errno));
+            exitStatus = 1;
+        }
+        else{
+            if(pid == 0){
+                _exit(scanTextFilters(first, filters, count, file, fdIn, last->fdOut));
+            }
+            PROBE2(spawn__end, COMMAND_ARGS(first)[0], pid);
+            waitForChild(pid, &exitStatus);
+            PROBE2(child__reaped, pid, exitStatus);
+            exitStatus = WEXITSTATUS(exitStatus);
+        }
+    }
+    
+    if(file && fdIn >= 0){
+        close(fdIn);
+    }
+    if(first->fdIn != fileno(stdin)){
+        close(first->fdIn);
+    }
+    if(last->fdOut != fileno(stdout)){
+        close(last->fdOut);
+    }
+    return exitStatus;
+}
+
+
+
+
+/*
+ Passes the lines read from fdIn through the filters in one scan and writes the lines
+ that come out of the last one to fdOut. A line is tested against each pattern and
+ projected by each cut in turn, in the same buffer, with no copying in between stages
+ that do not cut. When a head has let its last line through nothing more can come out,
+ so reading stops there and a program writing the input sees a closed pipe. Lines get a
+ newline if they had one or went through a grep or cut. grep takes input holding a NUL
+ byte for binary and reports matches instead of printing them, so once one turns up in a
+ pipeline with a grep the rest of the input goes to the real programs. Returns the exit
+ status of the pipeline as executeFusedFilters describes it.
+ */
+int scanTextFilters(const command_t *first, text_filter_t *filters, int count, const char *file, int fdIn, int fdOut){
+    
+    static char output[COPY_BUFFER_LEN];
+    text_filter_t *filter;
+    char *input, *scratch[2], *grown[3], *projected, *line, *newline = 0;
+    const char *field, *fieldEnd, *lineEnd;
+    size_t capacity = COPY_BUFFER_LEN, filled = 0, start, length, outLength = 0;
+    ssize_t got = 1;
+    long fieldNumber;
+    int addsNewline = 0, done = 0, hasGrep = 0, consumed = 0, passes, selected, i, j;
+    
+    
+    // the child may allocate; the buffers grow to hold the longest line
+    input = malloc(capacity);
+    scratch[0] = malloc(capacity);
+    scratch[1] = malloc(capacity);
+    if(!input || !scratch[0] || !scratch[1]){
+        done = -1;
+    }
+    for(i=0; i < count; ++i){
+        addsNewline |= (filters[i].kind != FILTER_HEAD);
+        hasGrep |= (filters[i].kind == FILTER_MATCH || filters[i].kind == FILTER_REJECT);
+        done |= (filters[i].kind == FILTER_HEAD && filters[i].limit == 0);
+    }
+    
+    while(!done && got > 0){
+        if(filled == capacity){
+            grown[0] = realloc(input, capacity*2);
+            input = grown[0] ? grown[0] : input;
+            grown[1] = realloc(scratch[0], capacity*2);
+            scratch[0] = grown[1] ? grown[1] : scratch[0];
+            grown[2] = realloc(scratch[1], capacity*2);
+            scratch[1] = grown[2] ? grown[2] : scratch[1];
+            if(!grown[0] || !grown[1] || !grown[2]){
+                done = -1;
+                break;
+            }
+            capacity *= 2;
+        }
+        while((got = read(fdIn, input+filled, capacity-filled)) < 0 && errno == EINTR);
+        if(got > 0 && hasGrep && memchr(input+filled, 0, got)){
+            writeAll(fdOut, output, outLength);
+            return runFilterPrograms(first, filters, count, file, consumed, input, filled+got, fdIn, fdOut);
+        }
+        filled += got > 0 ? got : 0;
+    
+        for(start=0; !done && start < filled; start += length + (newline != 0)){
+            newline = memchr(input+start, '\n', filled-start);
+            if(!newline && got > 0){
+                break; // the rest of the line is still to be read
+            }
+            consumed = 1;
+            line = input+start;
+            length = newline ? (size_t)(newline-line) : filled-start;
+            lineEnd = line+length;
+    
+            for(i=0, passes=1; passes && i < count; ++i){
+                filter = filters+i;
+                if(filter->kind == FILTER_MATCH || filter->kind == FILTER_REJECT){
+                    passes = (memmem(line, lineEnd-line, filter->pattern, filter->patternLength) != 0) ==
+                             (filter->kind == FILTER_MATCH);
+                }
+                else if(filter->kind == FILTER_FIELDS && !memchr(line, filter->delimiter, lineEnd-line)){
+                    passes = !filter->onlyDelimited; // a line without fields is kept whole
+                }
+                else if(filter->kind == FILTER_FIELDS){
+                    // the selected fields go, in input order, to the scratch buffer not in use
+                    projected = scratch[line == scratch[0]];
+                    length = 0;
+                    selected = 0;
+                    for(field=line, fieldNumber=1; field <= lineEnd; field=fieldEnd+1, ++fieldNumber){
+                        fieldEnd = memchr(field, filter->delimiter, lineEnd-field);
+                        fieldEnd = fieldEnd ? fieldEnd : lineEnd;
+                        for(j=0; j < filter->numRanges && (fieldNumber < filter->fieldFrom[j] ||
+                                                          fieldNumber > filter->fieldTo[j]); ++j);
+                        if(j < filter->numRanges){
+                            if(selected++){
+                                projected[length++] = filter->delimiter;
+                            }
+                            memcpy(projected+length, field, fieldEnd-field);
+                            length += fieldEnd-field;
+                        }
+                    }
+                    line = projected;
+                    lineEnd = projected+length;
+                }
+                if(passes && ++filter->passed == filter->limit && filter->kind == FILTER_HEAD){
+                    done = 1; // nothing can come out after this line
+                }
+            }
+            length = newline ? (size_t)(newline-(input+start)) : filled-start;
+            if(!passes){
+                continue;
+            }
+    
+            // the output is written in blocks; a line longer than the buffer goes directly
+            if(outLength + (lineEnd-line) + 1 > sizeof(output)){
+                done |= writeAll(fdOut, output, outLength) < 0;
+                outLength = 0;
+            }
+            if((size_t)(lineEnd-line) + 1 > sizeof(output)){
+                done |= writeAll(fdOut, line, lineEnd-line) < 0;
+                done |= writeAll(fdOut, "\n", newline || addsNewline) < 0;
+                continue;
+            }
+            memcpy(output+outLength, line, lineEnd-line);
+            outLength += lineEnd-line;
+            if(newline || addsNewline){
+                output[outLength++] = '\n';
+            }
+        }
+        memmove(input, input+start, filled-start);
+        filled -= start;
+    }
+    writeAll(fdOut, output, outLength);
+    free(input);
+    free(scratch[0]);
+    free(scratch[1]);
+    
+    if(done < 0){
+        fprintf(stderr, "Error! Not enough memory for the lines of '%s'.\n", COMMAND_ARGS(first)[0]);
+        return (filters[0].kind == FILTER_MATCH || filters[0].kind == FILTER_REJECT) ? 2 : 1;
+    }
+    return (filters[0].kind == FILTER_MATCH || filters[0].kind == FILTER_REJECT) && filters[0].passed == 0 && !done;
+}
+
+
+
+
+/*
+ Runs the stages of a fused pipeline as the programs they stand for, taking over from
+ scanTextFilters partway through its input. If nothing has been consumed and the first
+ stage names a file, the programs run as written. Otherwise the first reads pending, the
+ input the scan holds but has not passed through the filters, and then the rest of fdIn,
+ and a head that has already let lines through runs for the lines it has left. Returns
+ the exit status of the pipeline as executeFusedFilters describes it.
+ */
+int runFilterPrograms(const command_t *first, text_filter_t *filters, int count, const char *file, int consumed,
+                      const char *pending, size_t pendingLength, int fdIn, int fdOut){
+    
+    static char buffer[COPY_BUFFER_LEN];
+    const command_t *com = first;
+    char remaining[24];
+    arg_t *argList, *stageArgs;
+    pid_t pids[MAX_FUSED_FILTERS];
+    int feed[2] = {-1, -1}, stagePipe[2], stageIn, started, length, status, exitStatus = 1;
+    void (*pipeHandler)(int);
+    ssize_t got;
+    
+    
+    if((consumed || !file) && pipe(feed) < 0){
+        fprintf(stderr, "Error! Could not create pipe for command '%s': %s.\n", COMMAND_ARGS(first)[0], strerror(errno));
+        return 1;
+    }
+    
+    stageIn = feed[0];
+    for(started=0; started < count; ++started, com=NEXT_COMMAND(com)){
+        stagePipe[0] = stagePipe[1] = -1;
+        if(started < count-1 && pipe(stagePipe) < 0){
+            fprintf(stderr, "Error! Could not create pipe for command '%s': %s.\n", COMMAND_ARGS(com)[0], strerror(errno));
+            break;
+        }
+        pids[started] = forkCommand();
+        if(pids[started] == 0){
+            if(stageIn >= 0){
+                dup2(stageIn, fileno(stdin));
+                close(stageIn);
+            }
+            dup2(started < count-1 ? stagePipe[1] : fdOut, fileno(stdout));
+            if(stagePipe[0] >= 0){
+                close(stagePipe[0]);
+                close(stagePipe[1]);
+            }
+            if(feed[1] >= 0){
+                close(feed[1]);
+            }
+            
+            // the forked child may allocate, it is about to be replaced
+            argList = COMMAND_ARGS(com);
+            for(length=0; argList[length]; ++length);
+            stageArgs = malloc((length+3) * sizeof(arg_t));
+            if(filters[started].kind == FILTER_HEAD && filters[started].passed > 0){
+                snprintf(remaining, sizeof(remaining), "%ld", filters[started].limit - filters[started].passed);
+                stageArgs[0] = argList[0];
+                stageArgs[1] = "-n";
+                stageArgs[2] = remaining;
+                stageArgs[3] = 0;
+            }
+            else{
+                memcpy(stageArgs, argList, (length+1) * sizeof(arg_t));
+                if(started == 0 && file && feed[0] >= 0){
+                    stageArgs[length-1] = 0; // the input comes through the pipe instead
+                }
+            }
+            execCommand(stageArgs);
+        }
+        if(stageIn >= 0){
+            close(stageIn);
+        }
+        if(stagePipe[1] >= 0){
+            close(stagePipe[1]);
+        }
+        stageIn = stagePipe[0];
+        if(pids[started] < 0){
+            fprintf(stderr, "Error! Could not fork process for command '%s': %s.\n", COMMAND_ARGS(com)[0], strerror(errno));
+            break;
+        }
+    }
+    if(stageIn >= 0 && started < count){
+        close(stageIn);
+    }
+    
+    // a program that stops reading, such as a head, ends the feed without a signal
+    if(feed[1] >= 0){
+        pipeHandler = signal(SIGPIPE, SIG_IGN);
+        if(writeAll(feed[1], pending, pendingLength) == 0){
+            while((got = read(fdIn, buffer, sizeof(buffer))) != 0){
+                if(got < 0 && errno == EINTR){
+                    continue;
+                }
+                if(got < 0 || writeAll(feed[1], buffer, got) < 0){
+                    break;
+                }
+            }
+        }
+        close(feed[1]);
+        signal(SIGPIPE, pipeHandler);
+    }
+    
+    for(length=0; length < started; ++length){
+        waitForChild(pids[length], &status);
+        if(length == 0){
+            exitStatus = WIFEXITED(status) ? WEXITSTATUS(status) : 128+WTERMSIG(status);
+        }
+    }
+    
+    // a grep that let lines through before the handover has already succeeded
+    if((filters[0].kind == FILTER_MATCH || filters[0].kind == FILTER_REJECT) && filters[0].passed > 0 && exitStatus == 1){
+        exitStatus = 0;
+    }
+    return exitStatus;
+}
+
+
+
+
+/*
+ Returns the write-back options of the redirect open on fd in the current line, or 0.
+ */
+const write_options_t *findWriteOptions(int fd){
+    
+    int i;
+    
+    for(i=0; i < numWriteOptions; ++i){
+        if(writeOptions[i].fd == fd){
+            return writeOptions+i;
+        }
+    }
+    return 0;
+}
+
+
+
+
+/*
+ Runs the command with its output going through a pipe into the regular file on its
+ output redirect, which is written here according to options. The space for the output
+ is reserved before the command starts, and with a sync stride the file's dirty pages are
+ bounded to two strides: once a stride has been written its write-back is started, and
+ the shell waits for the stride before it to reach the disk (dropping it from the page
+ cache with dontneed) before taking more output. Unused reserved space is given back at
+ the end. Called in the child forked for the command; returns its exit status.
+ */
+int runWithWriteback(const command_t *command, const write_options_t *options){
+    
+    int fd = command->fdOut;
+    int dataPipe[2];
+    struct stat fileStat;
+    off_t start, written = 0, rangeStart = 0, previousStart = -1, stride;
+    ssize_t count;
+    char buffer[COPY_BUFFER_LEN];
+    int useSplice = 1;
+    int exitStatus;
+    pid_t pid;
+    
+    
+    if(fstat(fd, &fileStat) < 0 || !S_ISREG(fileStat.st_mode) || pipe(dataPipe) < 0){
+        dup2(command->fdIn, fileno(stdin));
+        dup2(fd, fileno(stdout));
+        execCommand(COMMAND_ARGS(command));
+    }
+    start = (fcntl(fd, F_GETFL) & O_APPEND) ? fileStat.st_size : lseek(fd, 0, SEEK_CUR);
+    stride = options->syncStride ? options->syncStride : (options->dropCache ? DEFAULT_SYNC_STRIDE : 0);
+    
+    // preallocation is only a hint, so file systems without it just grow the file
+    if(options->prealloc > 0){
+        fallocate(fd, FALLOC_FL_KEEP_SIZE, start, options->prealloc);
+    }
+    
+    pid = forkCommand();
+    if(pid < 0){
+        fprintf(stderr, "Error! Could not fork process for command '%s': %s.\n",
+                COMMAND_ARGS(command)[0], strerror(errno));
+        return 1;
+    }
+    else if(pid == 0){
+        close(dataPipe[0]);
+        dup2(command->fdIn, fileno(stdin));
+        dup2(dataPipe[1], fileno(stdout));
+        close(dataPipe[1]);
+        close(fd);
+        execCommand(COMMAND_ARGS(command));
+    }
+    close(dataPipe[1]);
+    
+    while(1){
+        // files opened for appending cannot be spliced into
+        count = useSplice ? splice(dataPipe[0], 0, fd, 0, COPY_BUFFER_LEN, SPLICE_F_MOVE) : -1;
+        if(count < 0 && useSplice && errno == EINVAL){
+            useSplice = 0;
+        }
+        if(!useSplice){
+            count = read(dataPipe[0], buffer, COPY_BUFFER_LEN);
+            if(count > 0 && writeAll(fd, buffer, count) < 0){
+                count = -1;
+            }
+        }
+        if(count < 0 && errno == EINTR){
+            continue;
+        }
+        if(count <= 0){
+            break;
+        }
+        written += count;
+        
+        if(stride && written-rangeStart >= stride){
+            sync_file_range(fd, start+rangeStart, written-rangeStart, SYNC_FILE_RANGE_WRITE);
+            if(previousStart >= 0){
+                sync_file_range(fd, start+previousStart, rangeStart-previousStart,
+                                SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+                if(options->dropCache){
+                    posix_fadvise(fd, start+previousStart, rangeStart-previousStart, POSIX_FADV_DONTNEED);
+                }
+            }
+            previousStart = rangeStart;
+            rangeStart = written;
+        }
+    }
+    if(count < 0){
+        fprintf(stderr, "Error! Could not write output of '%s': %s.\n", COMMAND_ARGS(command)[0], strerror(errno));
+    }
+    close(dataPipe[0]);
+    
+    if(options->dropCache && previousStart < written){
+        previousStart = previousStart < 0 ? 0 : previousStart;
+        sync_file_range(fd, start+previousStart, written-previousStart,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(fd, start+previousStart, written-previousStart, POSIX_FADV_DONTNEED);
+    }
+    if(options->prealloc > written){
+        ftruncate(fd, start+written); // frees the blocks reserved past the end
+    }
+    close(fd);
+    
+    waitForChild(pid, &exitStatus);
+    return count < 0 ? 1 : WEXITSTATUS(exitStatus);
+}
+
+
+
+
+/*
+ Splits the regular file on the command's input into byte ranges that end on a record
+ delimiter and feeds each range to its own instance of the command. Usage:
+ 
+   pmap [-j jobs] [-d delimiter] [-w host:port,...] [--] command [args...] < file
+ 
+ The file is mapped into memory only to locate the record boundaries; each range is
+ spliced straight from the file into its instance's input pipe. Instance outputs are
+ collected in scratch files and written out in chunk order. With -w the ranges are run
+ by worker daemons instead (see executeRemoteMap). Returns a sum of the exit status of
+ each instance.
+ */
+int executeParallelMap(const command_t *command){
+    
+    int jobs = 2;
+    char delimiter = '\n';
+    const char *workerList = 0;
+    arg_t *argList = COMMAND_ARGS(command)+1;
+    struct stat fileStat;
+    off_t chunkStart[MAX_PARALLEL_JOBS+1];
+    int chunkOut[MAX_PARALLEL_JOBS];
+    pid_t chunkPid[MAX_PARALLEL_JOBS];
+    int feedPipe[2];
+    pid_t pid;
+    off_t offset, end;
+    ssize_t sent;
+    char buffer[COPY_BUFFER_LEN];
+    int i, j, exitStatus, totalStatus = 0;
+    
+    
+    while(*argList && (*argList)[0] == '-'){
+        if(strcmp(*argList, "--") == 0){
+            ++argList;
+            break;
+        }
+        else if(strcmp(*argList, "-j") == 0 && *(argList+1)){
+            jobs = atoi(*(++argList));
+        }
+        else if(strcmp(*argList, "-d") == 0 && *(argList+1)){
+            delimiter = (*(++argList))[0];
+        }
+        else if(strcmp(*argList, "-w") == 0 && *(argList+1)){
+            workerList = *(++argList);
+        }
+        else{
+            fprintf(stderr, "Error! Unknown pmap option '%s'.\n", *argList);
+            return 1;
+        }
+        ++argList;
+    }
+    
+    if(!*argList){
+        fprintf(stderr, "Usage: pmap [-j jobs] [-d delimiter] [-w host:port,...] [--] command [args...] < file\n");
+        return 1;
+    }
+    if(jobs < 1 || jobs > MAX_PARALLEL_JOBS){
+        fprintf(stderr, "Error! pmap supports between 1 and %d jobs.\n", MAX_PARALLEL_JOBS);
+        return 1;
+    }
+    if(fstat(command->fdIn, &fileStat) < 0 || !S_ISREG(fileStat.st_mode)){
+        fprintf(stderr, "Error! pmap requires a regular file as input.\n");
+        return 1;
+    }
+    
+    
+    if(workerList){
+        return executeRemoteMap(command, argList, delimiter, workerList);
+    }
+    
+    if(!splitAtDelimiters(command->fdIn, fileStat.st_size, delimiter, jobs, chunkStart)){
+        fprintf(stderr, "Error! Could not map input file for pmap.\n");
+        return 1;
+    }
+    
+    
+    fflush(stdout);
+    for(i=0; i < jobs; ++i){
+        chunkOut[i] = openScratchFile();
+        if(chunkOut[i] < 0){
+            fprintf(stderr, "Error! Could not create output file for pmap.\n");
+            chunkPid[i] = -1;
+            continue;
+        }
+        
+        chunkPid[i] = forkCommand();
+        if(chunkPid[i] < 0){
+            fprintf(stderr, "Error! Could not fork process for command '%s': %s.\n", argList[0], strerror(errno));
+        }
+        else if(chunkPid[i] == 0){
+            // the instance only gets its own chunk's input and output
+            for(j=0; j < i; ++j){
+                if(chunkOut[j] >= 0){
+                    close(chunkOut[j]);
+                }
+            }
+            if(command->fdOut != fileno(stdout)){
+                close(command->fdOut);
+            }
+            signal(SIGPIPE, SIG_IGN);
+            if(pipe(feedPipe) < 0){
+                fprintf(stderr, "Error! Could not create pipe for command '%s': %s.\n", argList[0], strerror(errno));
+                _exit(1);
+            }
+            
+            pid = forkCommand();
+            if(pid < 0){
+                fprintf(stderr, "Error! Could not fork process for command '%s': %s.\n", argList[0], strerror(errno));
+                _exit(1);
+            }
+            else if(pid == 0){
+                signal(SIGPIPE, SIG_DFL);
+                dup2(feedPipe[0], fileno(stdin));
+                dup2(chunkOut[i], fileno(stdout));
+                close(feedPipe[0]);
+                close(feedPipe[1]);
+                close(chunkOut[i]);
+                if(command->fdIn != fileno(stdin)){
+                    close(command->fdIn);
+                }
+                
+                execCommand(argList);
+            }
+            
+            // feed the chunk without copying it through user space when possible
+            close(feedPipe[0]);
+            offset = chunkStart[i];
+            end = chunkStart[i+1];
+            while(offset < end){
+                sent = splice(command->fdIn, &offset, feedPipe[1], 0, end-offset, SPLICE_F_MORE);
+                if(sent < 0 && errno == EINVAL){
+                    sent = pread(command->fdIn, buffer,
+                                 (end-offset) < COPY_BUFFER_LEN ? (end-offset) : COPY_BUFFER_LEN, offset);
+                    if(sent > 0){
+                        sent = write(feedPipe[1], buffer, sent);
+                        offset += sent > 0 ? sent : 0;
+                    }
+                }
+                if(sent == 0 || (sent < 0 && errno != EINTR)){
+                    break;
+                }
+            }
+            close(feedPipe[1]);
+            
+            waitpid(pid, &exitStatus, 0);
+            _exit(WEXITSTATUS(exitStatus));
+        }
+    }
+    
+    
+    for(i=0; i < jobs; ++i){
+        if(chunkPid[i] > 0){
+            waitForChild(chunkPid[i], &exitStatus);
+            totalStatus += WEXITSTATUS(exitStatus);
+            copyFileContents(chunkOut[i], command->fdOut);
+        }
+        else{
+            ++totalStatus;
+        }
+        if(chunkOut[i] >= 0){
+            close(chunkOut[i]);
+        }
+    }
+    
+    return totalStatus;
+}
+
+
+
+
+/*
+ Fills chunkStart[0..chunks] with offsets that split the first size bytes of the file on
+ fd into chunks ranges of about equal length, each ending just after a delimiter so no
+ record is cut in two. The file is mapped only to search for delimiters. Returns 0 if it
+ could not be mapped.
+ */
+int splitAtDelimiters(int fd, off_t size, char delimiter, int chunks, off_t *chunkStart){
+    
+    char *data = 0, *boundary;
+    off_t offset;
+    int i;
+    
+    
+    chunkStart[0] = 0;
+    chunkStart[chunks] = size;
+    if(size > 0){
+        data = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(data == MAP_FAILED){
+            return 0;
+        }
+    }
+    
+    // find a delimiter at or after each even split point
+    for(i=1; i < chunks; ++i){
+        offset = size / chunks * i;
+        if(offset < chunkStart[i-1]){
+            offset = chunkStart[i-1];
+        }
+        boundary = offset < size ? memchr(data+offset, delimiter, size-offset) : 0;
+        chunkStart[i] = boundary ? (boundary-data)+1 : size;
+    }
+    if(data){
+        munmap(data, size);
+    }
+    return 1;
+}
+
+
+
+
+/*
+ Runs pmap on worker daemons (microshell --worker). The input file is split into tasks of
+ about REMOTE_TASK_LEN bytes, at least a few per worker, and each worker connection runs
+ one task at a time: the command line and the task's bytes are sent to it, and its
+ output, errors and exit status are streamed back. Tasks are dealt out to the workers in
+ contiguous runs; a worker that finishes its run steals tasks from the back of the
+ longest remaining run, so faster workers take on more. When a worker is lost, one
+ reconnection to the same daemon is tried, and the task it was running is retried
+ preferably on a worker on the same host, up to MAX_TASK_ATTEMPTS times. Outputs are
+ written in task order as soon as every earlier task has finished. Returns a sum of the
+ exit status of each task.
+ */
+int executeRemoteMap(const command_t *command, arg_t *argList, char delimiter, const char *workerList){
+    
+    static worker_t workers[MAX_WORKERS];
+    static off_t taskStart[MAX_REMOTE_TASKS+1];
+    static int taskState[MAX_REMOTE_TASKS], taskOut[MAX_REMOTE_TASKS], taskAttempts[MAX_REMOTE_TASKS];
+    static int retryTask[MAX_REMOTE_TASKS];
+    static char retryHost[MAX_REMOTE_TASKS][MAX_HOST_LEN];
+    static char payload[MAX_FRAME_LEN];
+    struct pollfd pollers[MAX_WORKERS];
+    int pollWorker[MAX_WORKERS];
+    int runStart[MAX_WORKERS], runEnd[MAX_WORKERS];
+    struct stat fileStat;
+    const char *c, *colon, *comma;
+    int numWorkers = 0, numTasks, numRetries = 0, nextEmit = 0, alive = 0;
+    int i, w, task, best, numPollers, totalStatus = 0;
+    uint32_t status;
+    size_t length;
+    char type;
+    
+    
+    // host:port,host:port,... where listing a daemon twice gives it two connections
+    for(c=workerList; *c && numWorkers < MAX_WORKERS; c = *comma ? comma+1 : comma){
+        comma = strchr(c, ',') ? strchr(c, ',') : c+strlen(c);
+        colon = memrchr(c, ':', comma-c);
+        if(!colon || colon == c || colon-c >= MAX_HOST_LEN || comma-colon-1 >= (long)sizeof(workers[0].port)){
+            fprintf(stderr, "Error! pmap workers are given as host:port,host:port.\n");
+            return 1;
+        }
+        snprintf(workers[numWorkers].host, MAX_HOST_LEN, "%.*s", (int)(colon-c), c);
+        snprintf(workers[numWorkers].port, sizeof(workers[0].port), "%.*s", (int)(comma-colon-1), colon+1);
+        workers[numWorkers].task = -1;
+        workers[numWorkers].fd = connectWorker(workers+numWorkers);
+        if(workers[numWorkers].fd < 0){
+            fprintf(stderr, "Error! Could not connect to pmap worker %s:%s.\n", workers[numWorkers].host, workers[numWorkers].port);
+        }
+        else{
+            ++alive;
+        }
+        ++numWorkers;
+    }
+    if(!alive){
+        return 1;
+    }
+    
+    fstat(command->fdIn, &fileStat);
+    numTasks = fileStat.st_size / REMOTE_TASK_LEN + 1;
+    numTasks = numTasks < numWorkers*4 ? numWorkers*4 : numTasks;
+    numTasks = numTasks > MAX_REMOTE_TASKS ? MAX_REMOTE_TASKS : numTasks;
+    if(!splitAtDelimiters(command->fdIn, fileStat.st_size, delimiter, numTasks, taskStart)){
+        fprintf(stderr, "Error! Could not map input file for pmap.\n");
+        for(w=0; w < numWorkers; ++w){
+            if(workers[w].fd >= 0){
+                close(workers[w].fd);
+            }
+        }
+        return 1;
+    }
+    for(task=0; task < numTasks; ++task){
+        taskState[task] = TASK_PENDING;
+        taskOut[task] = -1;
+        taskAttempts[task] = 0;
+    }
+    for(w=0; w < numWorkers; ++w){
+        runStart[w] = numTasks * w / numWorkers;
+        runEnd[w] = numTasks * (w+1) / numWorkers;
+    }
+    
+    
+    fflush(stdout);
+    while(nextEmit < numTasks){
+        
+        // hand every idle worker a task: a retry from its own host, its own run, any
+        // retry, then the back of the longest run left
+        for(w=0; w < numWorkers; ++w){
+            while(workers[w].fd >= 0 && workers[w].task < 0){
+                for(i=0; i < numRetries && strcmp(retryHost[i], workers[w].host) != 0; ++i);
+                if(i == numRetries && runStart[w] == runEnd[w] && numRetries > 0){
+                    i = 0;
+                }
+                if(i < numRetries){
+                    task = retryTask[i];
+                    retryTask[i] = retryTask[--numRetries];
+                    memcpy(retryHost[i], retryHost[numRetries], MAX_HOST_LEN);
+                }
+                else if(runStart[w] < runEnd[w]){
+                    task = runStart[w]++;
+                }
+                else{
+                    for(best=-1, i=0; i < numWorkers; ++i){
+                        if(runEnd[i]-runStart[i] > 0 && (best < 0 || runEnd[i]-runStart[i] > runEnd[best]-runStart[best])){
+                            best = i;
+                        }
+                    }
+                    if(best < 0){
+                        break;
+                    }
+                    task = --runEnd[best];
+                }
+                
+                ++taskAttempts[task];
+                if(taskOut[task] < 0){
+                    taskOut[task] = openScratchFile();
+                }
+                else{
+                    ftruncate(taskOut[task], 0); // drop the output of a lost attempt
+                }
+                workers[w].task = task;
+                taskState[task] = TASK_RUNNING;
+                if(taskOut[task] < 0 || sendRemoteTask(workers+w, argList, command->fdIn, taskStart[task], taskStart[task+1]) < 0){
+                    loseWorker(workers+w, retryTask, retryHost, &numRetries, taskState, taskAttempts, &alive);
+                }
+            }
+        }
+        
+        numPollers = 0;
+        for(w=0; w < numWorkers; ++w){
+            if(workers[w].fd >= 0 && workers[w].task >= 0){
+                pollers[numPollers].fd = workers[w].fd;
+                pollers[numPollers].events = POLLIN;
+                pollWorker[numPollers++] = w;
+            }
+        }
+        if(!numPollers){
+            // nothing is running, so every task left has failed for good
+            for(task=nextEmit; task < numTasks; ++task){
+                if(taskState[task] == TASK_PENDING){
+                    fprintf(stderr, "Error! pmap task %d could not be run on any worker.\n", task);
+                    taskState[task] = TASK_FAILED;
+                }
+            }
+        }
+        else if(poll(pollers, numPollers, -1) < 0){
+            if(errno != EINTR){
+                break;
+            }
+            continue;
+        }
+        
+        for(i=0; i < numPollers; ++i){
+            if(!pollers[i].revents){
+                continue;
+            }
+            w = pollWorker[i];
+            task = workers[w].task;
+            
+            if(!readFrame(workers[w].fd, &type, payload, &length)){
+                loseWorker(workers+w, retryTask, retryHost, &numRetries, taskState, taskAttempts, &alive);
+            }
+            else if(type == FRAME_OUTPUT){
+                writeAll(taskOut[task], payload, length);
+            }
+            else if(type == FRAME_ERROR){
+                writeAll(fileno(stderr), payload, length);
+            }
+            else if(type == FRAME_EXIT && length == sizeof(status)){
+                memcpy(&status, payload, sizeof(status));
+                totalStatus += ntohl(status);
+                taskState[task] = TASK_DONE;
+                workers[w].task = -1;
+            }
+        }
+        
+        // write out every finished task that has no unfinished task before it
+        while(nextEmit < numTasks && (taskState[nextEmit] == TASK_DONE || taskState[nextEmit] == TASK_FAILED)){
+            totalStatus += taskState[nextEmit] == TASK_FAILED;
+            if(taskOut[nextEmit] >= 0){
+                copyFileContents(taskOut[nextEmit], command->fdOut);
+                close(taskOut[nextEmit]);
+            }
+            ++nextEmit;
+        }
+    }
+    
+    for(w=0; w < numWorkers; ++w){
+        if(workers[w].fd >= 0){
+            close(workers[w].fd);
+        }
+    }
+    return totalStatus;
+}
+
+
+
+
+/*
+ Handles a lost worker connection for executeRemoteMap. The daemon is reconnected to once
+ in case only the connection was lost; the task that was in flight goes on the retry list
+ tagged with the worker's host, or fails once it has been tried MAX_TASK_ATTEMPTS times.
+ */
+void loseWorker(worker_t *worker, int *retryTask, char (*retryHost)[MAX_HOST_LEN], int *numRetries,
+                int *taskState, int *taskAttempts, int *alive){
+    
+    int task = worker->task;
+    
+    
+    close(worker->fd);
+    worker->fd = connectWorker(worker);
+    worker->task = -1;
+    if(worker->fd < 0){
+        fprintf(stderr, "Error! Lost pmap worker %s:%s.\n", worker->host, worker->port);
+        --(*alive);
+    }
+    
+    if(task < 0){
+        return;
+    }
+    if(taskAttempts[task] >= MAX_TASK_ATTEMPTS){
+        fprintf(stderr, "Error! pmap task %d failed on %d workers.\n", task, taskAttempts[task]);
+        taskState[task] = TASK_FAILED;
+        return;
+    }
+    taskState[task] = TASK_PENDING;
+    retryTask[*numRetries] = task;
+    memcpy(retryHost[*numRetries], worker->host, MAX_HOST_LEN);
+    ++(*numRetries);
+}
+
+
+
+
+/*
+ Sends a task to a worker: the command line as one frame, then the bytes of the input file
+ from start to end, then an end of input frame. Returns 0 on success or -1 if the worker
+ could not be written to.
+ */
+int sendRemoteTask(worker_t *worker, arg_t *argList, int fdIn, off_t start, off_t end){
+    
+    static char payload[MAX_FRAME_LEN];
+    size_t length = 0, argLength;
+    ssize_t count;
+    int i;
+    
+    
+    for(i=0; argList[i]; ++i){
+        argLength = strlen(argList[i])+1;
+        if(length+argLength > MAX_FRAME_LEN){
+            return -1;
+        }
+        memcpy(payload+length, argList[i], argLength);
+        length += argLength;
+    }
+    if(sendFrame(worker->fd, FRAME_COMMAND, payload, length) < 0){
+        return -1;
+    }
+    
+    while(start < end){
+        count = pread(fdIn, payload, end-start < MAX_FRAME_LEN ? end-start : MAX_FRAME_LEN, start);
+        if(count < 0 && errno == EINTR){
+            continue;
+        }
+        if(count <= 0 || sendFrame(worker->fd, FRAME_INPUT, payload, count) < 0){
+            return -1;
+        }
+        start += count;
+    }
+    return sendFrame(worker->fd, FRAME_END, 0, 0);
+}
+
+
+
+
+/*
+ Opens a TCP connection to a worker daemon. Returns the socket, or -1 on failure.
+ */
+int connectWorker(const worker_t *worker){
+    
+    struct addrinfo hints, *addresses, *address;
+    int fd = -1, on = 1;
+    
+    
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    ALLOW_ALLOCATIONS(1);
+    if(getaddrinfo(worker->host, worker->port, &hints, &addresses) != 0){
+        ALLOW_ALLOCATIONS(0);
+        return -1;
+    }
+    for(address=addresses; address; address=address->ai_next){
+        fd = socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol);
+        if(fd >= 0 && connect(fd, address->ai_addr, address->ai_addrlen) == 0){
+            break;
+        }
+        if(fd >= 0){
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    ALLOW_ALLOCATIONS(0);
+    
+    // frames are small and latency bound
+    if(fd >= 0){
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    return fd;
+}
+
+
+
+
+/*
+ Sends one frame of the worker protocol: a type byte, the payload length as a 32-bit big
+ endian number and the payload. Returns 0 on success or -1 on error; a closed peer does
+ not raise SIGPIPE.
+ */
+int sendFrame(int fd, char type, const char *data, size_t length){
+    
+    char header[FRAME_HEADER_LEN];
+    uint32_t networkLength = htonl(length);
+    struct iovec vectors[2];
+    struct msghdr message;
+    ssize_t sent;
+    
+    
+    header[0] = type;
+    memcpy(header+1, &networkLength, sizeof(networkLength));
+    vectors[0].iov_base = header;
+    vectors[0].iov_len = FRAME_HEADER_LEN;
+    vectors[1].iov_base = (char *)data;
+    vectors[1].iov_len = length;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = vectors;
+    message.msg_iovlen = 2;
+    
+    while(vectors[0].iov_len + vectors[1].iov_len > 0){
+        sent = sendmsg(fd, &message, MSG_NOSIGNAL);
+        if(sent < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return -1;
+        }
+        
+        // skip what was sent in both vectors
+        if((size_t)sent >= vectors[0].iov_len){
+            sent -= vectors[0].iov_len;
+            vectors[0].iov_len = 0;
+            vectors[1].iov_base = (char *)vectors[1].iov_base + sent;
+            vectors[1].iov_len -= sent;
+        }
+        else{
+            vectors[0].iov_base = (char *)vectors[0].iov_base + sent;
+            vectors[0].iov_len -= sent;
+        }
+    }
+    return 0;
+}
+
+
+
+
+/*
+ Reads one frame of the worker protocol into data, which holds MAX_FRAME_LEN bytes.
+ Returns 0 if the connection closed, failed or sent a malformed frame.
+ */
+int readFrame(int fd, char *type, char *data, size_t *length){
+    
+    char header[FRAME_HEADER_LEN];
+    uint32_t networkLength;
+    
+    
+    if(readAll(fd, header, FRAME_HEADER_LEN) < 0){
+        return 0;
+    }
+    *type = header[0];
+    memcpy(&networkLength, header+1, sizeof(networkLength));
+    *length = ntohl(networkLength);
+    
+    return *length <= MAX_FRAME_LEN && readAll(fd, data, *length) == 0;
+}
+
+
+
+
+/*
+ Reads exactly length bytes from fd into data, retrying short reads. Returns 0 on
+ success or -1 on error or end of file.
+ */
+int readAll(int fd, char *data, size_t length){
+    
+    ssize_t count;
+    
+    while(length > 0){
+        count = read(fd, data, length);
+        if(count < 0 && errno == EINTR){
+            continue;
+        }
+        if(count <= 0){
+            return -1;
+        }
+        data += count;
+        length -= count;
+    }
+    return 0;
+}
+
+
+
+
+/*
+ Runs the shell as a worker daemon for pmap -w, listening on [host:]port (the loopback
+ interface when no host is given; workers run whatever they are sent, so they belong on
+ trusted networks only). Each coordinator connection is served by its own process.
+ Returns 1 if the daemon could not start.
+ */
+int runWorker(const char *address){
+    
+    struct addrinfo hints, *addresses;
+    char host[MAX_HOST_LEN];
+    const char *colon = strrchr(address, ':');
+    int listenFd = -1, fd, on = 1;
+    pid_t pid;
+    
+    
+    snprintf(host, MAX_HOST_LEN, "%.*s", colon ? (int)(colon-address) : 0, address);
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if(getaddrinfo(host[0] ? host : "127.0.0.1", colon ? colon+1 : address, &hints, &addresses) == 0){
+        listenFd = socket(addresses->ai_family, addresses->ai_socktype | SOCK_CLOEXEC, addresses->ai_protocol);
+        if(listenFd >= 0){
+            setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+            if(bind(listenFd, addresses->ai_addr, addresses->ai_addrlen) < 0 || listen(listenFd, 64) < 0){
+                close(listenFd);
+                listenFd = -1;
+            }
+        }
+        freeaddrinfo(addresses);
+    }
+    if(listenFd < 0){
+        fprintf(stderr, "Error! Could not listen on '%s' for pmap workers.\n", address);
+        return 1;
+    }
+    
+    // connection processes are never waited for
+    signal(SIGCHLD, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);
+    
+    while(1){
+        fd = accept4(listenFd, 0, 0, SOCK_CLOEXEC);
+        if(fd < 0){
+            if(errno != EINTR && errno != ECONNABORTED){
+                sleep(1); // out of descriptors or memory; connections wait in the backlog
+            }
+            continue;
+        }
+        
+        pid = forkCommand();
+        if(pid == 0){
+            close(listenFd);
+            signal(SIGCHLD, SIG_DFL);
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            _exit(serveCoordinator(fd));
+        }
+        close(fd);
+    }
+}
+
+
+
+
+/*
+ Serves one coordinator connection of a worker daemon, running its tasks one after
+ another. A task's input is spooled into a scratch file before the command starts, so the
+ coordinator never blocks sending input while the worker is sending output. Output and
+ errors are streamed back as they are produced, followed by the exit status. Returns
+ when the coordinator disconnects.
+ */
+int serveCoordinator(int fd){
+    
+    static char command[MAX_FRAME_LEN], payload[MAX_FRAME_LEN];
+    static arg_t argList[MAX_FRAME_LEN/2+1];
+    struct pollfd pollers[2];
+    int outPipe[2], errPipe[2], inputFile, openPipes, received, i, numArgs, exitStatus;
+    uint32_t status;
+    size_t length, offset;
+    ssize_t count;
+    char type, frameType;
+    pid_t pid;
+    
+    
+    while(readFrame(fd, &type, command, &length)){
+        if(type != FRAME_COMMAND || length == 0 || command[length-1] != 0){
+            return 1;
+        }
+        for(numArgs=0, offset=0; offset < length; offset += strlen(command+offset)+1){
+            argList[numArgs++] = command+offset;
+        }
+        argList[numArgs] = 0;
+        
+        inputFile = openScratchFile();
+        while((received = readFrame(fd, &type, payload, &length)) && type == FRAME_INPUT){
+            if(inputFile < 0 || writeAll(inputFile, payload, length) < 0){
+                return 1;
+            }
+        }
+        if(!received || type != FRAME_END){
+            return 1; // the coordinator went away mid-task
+        }
+        lseek(inputFile, 0, SEEK_SET);
+        
+        if(pipe2(outPipe, O_CLOEXEC) < 0 || pipe2(errPipe, O_CLOEXEC) < 0 || (pid = forkCommand()) < 0){
+            return 1;
+        }
+        if(pid == 0){
+            dup2(inputFile, fileno(stdin));
+            dup2(outPipe[1], fileno(stdout));
+            dup2(errPipe[1], fileno(stderr));
+            execCommand(argList);
+        }
+        close(inputFile);
+        close(outPipe[1]);
+        close(errPipe[1]);
+        
+        pollers[0].fd = outPipe[0];
+        pollers[1].fd = errPipe[0];
+        pollers[0].events = pollers[1].events = POLLIN;
+        for(openPipes=2; openPipes > 0; ){
+            if(poll(pollers, 2, -1) < 0){
+                continue;
+            }
+            for(i=0; i < 2; ++i){
+                if(!pollers[i].revents){
+                    continue;
+                }
+                count = read(pollers[i].fd, payload, MAX_FRAME_LEN);
+                frameType = i == 0 ? FRAME_OUTPUT : FRAME_ERROR;
+                if(count > 0){
+                    if(sendFrame(fd, frameType, payload, count) < 0){
+                        return 1;
+                    }
+                }
+                else if(count == 0 || errno != EINTR){
+                    close(pollers[i].fd);
+                    pollers[i].fd = -1;
+                    --openPipes;
+                }
+            }
+        }
+        
+        waitpid(pid, &exitStatus, 0);
+        status = htonl(WIFEXITED(exitStatus) ? WEXITSTATUS(exitStatus) : 128+WTERMSIG(exitStatus));
+        if(sendFrame(fd, FRAME_EXIT, (char *)&status, sizeof(status)) < 0){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+
+
+/*
+ Runs a pipeline stage written as |N| command. Input is cut into blocks that end on a
+ newline, and each block is handed to a fresh instance of the command with at most N
+ instances running at once. A line longer than a block is not cut: the rest of it is
+ read into the same block's input. When the input pauses for REPLICA_FLUSH_MILLIS the
+ block is cut at its last full line and the blocks already running are written out, so
+ a slow producer is not held back until a whole block has arrived. Every block's output
+ is held in a scratch file tagged by the block's sequence number and written out in
+ input order, so the stage produces the same output as a single instance of a stateless
+ line filter. Returns the last nonzero exit status of an instance, or 0.
+ */
+int executeReplicatedCommand(const command_t *command){
+    
+    static char block[REPLICA_BLOCK_LEN];
+    int replicas = command->replicas;
+    int blockOut[MAX_PARALLEL_JOBS];
+    pid_t blockPid[MAX_PARALLEL_JOBS];
+    int blockIn, slot, pendingIn = -1;
+    unsigned long seqNext = 0, seqEmit = 0;
+    size_t used = 0, length;
+    ssize_t count;
+    char *lastNewline;
+    struct pollfd poller;
+    int eof = 0, partial, idle, ready;
+    int exitStatus, lastStatus = 0;
+    
+    
+    if(replicas > MAX_PARALLEL_JOBS){
+        replicas = MAX_PARALLEL_JOBS;
+    }
+    poller.fd = command->fdIn;
+    poller.events = POLLIN;
+    
+    while(1){
+        
+        // start an instance for each new block while the reorder window has room
+        idle = 0;
+        while(seqNext - seqEmit < (unsigned long)replicas && !(eof && used == 0 && seqNext > 0 && pendingIn < 0)){
+            
+            slot = seqNext % replicas;
+            
+            // a block whose instance could not be forked is still waiting in its scratch file
+            blockIn = pendingIn;
+            pendingIn = -1;
+            if(blockIn < 0){
+                while(!eof && used < REPLICA_BLOCK_LEN){
+                    // once the input pauses, cut the block or write out the running ones
+                    if(used > 0 || seqNext > seqEmit){
+                        ready = poll(&poller, 1, idle ? 0 : REPLICA_FLUSH_MILLIS);
+                        if(ready < 0 && errno == EINTR){
+                            continue;
+                        }
+                        if(ready == 0){
+                            if(memchr(block, '\n', used) || seqNext > seqEmit){
+                                idle = 1;
+                                break;
+                            }
+                            continue;
+                        }
+                    }
+                    count = read(command->fdIn, block+used, REPLICA_BLOCK_LEN-used);
+                    if(count < 0 && errno == EINTR){
+                        continue;
+                    }
+                    if(count <= 0){
+                        eof = 1;
+                        break;
+                    }
+                    used += count;
+                }
+                
+                length = used;
+                lastNewline = eof ? 0 : memrchr(block, '\n', used);
+                if(idle && !lastNewline){
+                    break;
+                }
+                if(lastNewline){
+                    length = (lastNewline-block)+1;
+                }
+                partial = !eof && !lastNewline;
+                
+                blockIn = openScratchFile();
+                if(blockIn < 0 || writeAll(blockIn, block, length) < 0){
+                    fprintf(stderr, "Error! Could not buffer input for command '%s'.\n", COMMAND_ARGS(command)[0]);
+                    _exit(1);
+                }
+                memmove(block, block+length, used-length);
+                used -= length;
+                
+                // a line that fills the whole block goes on into this block up to its newline
+                while(partial){
+                    count = read(command->fdIn, block, REPLICA_BLOCK_LEN);
+                    if(count < 0 && errno == EINTR){
+                        continue;
+                    }
+                    if(count <= 0){
+                        eof = 1;
+                        break;
+                    }
+                    lastNewline = memchr(block, '\n', count);
+                    length = lastNewline ? (size_t)(lastNewline-block)+1 : (size_t)count;
+                    if(writeAll(blockIn, block, length) < 0){
+                        fprintf(stderr, "Error! Could not buffer input for command '%s'.\n", COMMAND_ARGS(command)[0]);
+                        _exit(1);
+                    }
+                    memmove(block, block+length, count-length);
+                    used = count-length;
+                    partial = !lastNewline;
+                }
+            }
+            lseek(blockIn, 0, SEEK_SET);
+            
+            blockOut[slot] = openScratchFile();
+            if(blockOut[slot] < 0){
+                fprintf(stderr, "Error! Could not buffer output for command '%s'.\n", COMMAND_ARGS(command)[0]);
+                _exit(1);
+            }
+            
+            // without a process to spare the window shrinks until an instance finishes
+            blockPid[slot] = forkCommand();
+            if(blockPid[slot] < 0){
+                close(blockOut[slot]);
+                pendingIn = blockIn;
+                if(seqNext == seqEmit){
+                    close(pendingIn);
+                    fprintf(stderr, "Error! Could not fork process for command '%s': %s.\n",
+                            COMMAND_ARGS(command)[0], strerror(errno));
+                    return 1;
+                }
+                break;
+            }
+            else if(blockPid[slot] == 0){
+                dup2(blockIn, fileno(stdin));
+                dup2(blockOut[slot], fileno(stdout));
+                close(blockIn);
+                close(blockOut[slot]);
+                
+                execCommand(COMMAND_ARGS(command));
+            }
+            close(blockIn);
+            ++seqNext;
+        }
+        
+        if(seqEmit == seqNext){
+            break;
+        }
+        
+        // emit the oldest block once its instance has finished, or every block while idle
+        do{
+            slot = seqEmit % replicas;
+            waitForChild(blockPid[slot], &exitStatus);
+            if(WEXITSTATUS(exitStatus)){
+                lastStatus = WEXITSTATUS(exitStatus);
+            }
+            copyFileContents(blockOut[slot], command->fdOut);
+            close(blockOut[slot]);
+            ++seqEmit;
+        } while(idle && seqEmit < seqNext);
+    }
+    
+    return lastStatus;
+}
+
+
+
+
+/*
+ Runs a pipeline stage written as |N:F| command. N consumer instances of the command are
+ started up front, and each input line is routed to the consumer selected by hashing its
+ F-th whitespace separated field (the whole line when F is 0), so all lines sharing a key
+ reach the same consumer. A line longer than a block is hashed on its first block and
+ the rest of it is sent to the same consumer. Lines are batched per consumer to keep the
+ number of pipe writes low. Consumer outputs are written out one after another in consumer order, ready
+ for an optional merge stage later in the pipeline. Returns the last nonzero exit status
+ of a consumer, or 0.
+ */
+int executePartitionedCommand(const command_t *command){
+    
+    static char block[REPLICA_BLOCK_LEN];
+    static char batch[MAX_PARALLEL_JOBS][PARTITION_BATCH_LEN];
+    size_t batchLen[MAX_PARALLEL_JOBS];
+    int consumerIn[MAX_PARALLEL_JOBS];
+    int consumerOut[MAX_PARALLEL_JOBS];
+    pid_t consumerPid[MAX_PARALLEL_JOBS];
+    int consumers = command->replicas;
+    int inPipe[2];
+    size_t used = 0, lineStart, lineLength;
+    ssize_t count;
+    char *newline;
+    int eof = 0, continued = -1;
+    int i, exitStatus, lastStatus = 0;
+    
+    
+    if(consumers > MAX_PARALLEL_JOBS){
+        consumers = MAX_PARALLEL_JOBS;
+    }
+    signal(SIGPIPE, SIG_IGN); // a consumer that exits early only loses its own lines
+    
+    for(i=0; i < consumers; ++i){
+        consumerOut[i] = openScratchFile();
+        
+        // write ends are close-on-exec so each consumer sees EOF once the stage finishes
+        if(consumerOut[i] < 0 || pipe2(inPipe, O_CLOEXEC) < 0){
+            fprintf(stderr, "Error! Could not create pipes for command '%s'.\n", COMMAND_ARGS(command)[0]);
+            _exit(1);
+        }
+        
+        // without a process to spare the lines are partitioned among fewer consumers
+        consumerPid[i] = forkCommand();
+        if(consumerPid[i] < 0){
+            fprintf(stderr, "Error! Could not fork process for command '%s': %s.\n",
+                    COMMAND_ARGS(command)[0], strerror(errno));
+            close(consumerOut[i]);
+            close(inPipe[0]);
+            close(inPipe[1]);
+            if(!i){
+                return 1;
+            }
+            consumers = i;
+            break;
+        }
+        else if(consumerPid[i] == 0){
+            signal(SIGPIPE, SIG_DFL);
+            dup2(inPipe[0], fileno(stdin));
+            dup2(consumerOut[i], fileno(stdout));
+            
+            execCommand(COMMAND_ARGS(command));
+        }
+        
+        close(inPipe[0]);
+        consumerIn[i] = inPipe[1];
+        batchLen[i] = 0;
+    }
+    
+    
+    while(!eof){
+        count = read(command->fdIn, block+used, REPLICA_BLOCK_LEN-used);
+        if(count < 0 && errno == EINTR){
+            continue;
+        }
+        if(count <= 0){
+            eof = 1;
+        }
+        else{
+            used += count;
+        }
+        
+        // route every complete line, plus a trailing partial line at end of input or
+        // a line too long to fit in the block
+        lineStart = 0;
+        while(lineStart < used){
+            newline = memchr(block+lineStart, '\n', used-lineStart);
+            if(newline){
+                lineLength = (newline-(block+lineStart))+1;
+            }
+            else if(eof || (lineStart == 0 && used == REPLICA_BLOCK_LEN)){
+                lineLength = used-lineStart;
+            }
+            else{
+                break;
+            }
+            
+            // the rest of a line too long for the block follows its head to the same consumer
+            if(continued >= 0){
+                i = continued;
+            }
+            else{
+                i = hashLineField(block+lineStart, lineLength, command->partitionField) % consumers;
+            }
+            continued = newline ? -1 : i;
+            if(batchLen[i]+lineLength > PARTITION_BATCH_LEN){
+                writeAll(consumerIn[i], batch[i], batchLen[i]);
+                batchLen[i] = 0;
+            }
+            if(lineLength > PARTITION_BATCH_LEN){
+                writeAll(consumerIn[i], block+lineStart, lineLength);
+            }
+            else{
+                memcpy(batch[i]+batchLen[i], block+lineStart, lineLength);
+                batchLen[i] += lineLength;
+            }
+            lineStart += lineLength;
+        }
+        
+        memmove(block, block+lineStart, used-lineStart);
+        used -= lineStart;
+    }
+    
+    
+    for(i=0; i < consumers; ++i){
+        writeAll(consumerIn[i], batch[i], batchLen[i]);
+        close(consumerIn[i]);
+    }
+    for(i=0; i < consumers; ++i){
+        waitForChild(consumerPid[i], &exitStatus);
+        if(WEXITSTATUS(exitStatus)){
+            lastStatus = WEXITSTATUS(exitStatus);
+        }
+        copyFileContents(consumerOut[i], command->fdOut);
+        close(consumerOut[i]);
+    }
+    
+    return lastStatus;
+}
+
+
+
+
+/*
+ Returns an FNV-1a hash of the given field of a line. Fields are separated by runs of
+ spaces and tabs, counting from 1; field 0 or a missing field hashes the whole line
+ (or the empty string for a missing field) without its trailing newline.
+ */
+unsigned long hashLineField(const char *line, size_t length, int field){
+    
+    unsigned long hash = 2166136261UL;
+    const char *c = line;
+    const char *end = line+length;
+    
+    if(length > 0 && *(end-1) == '\n'){
+        --end;
+    }
+    
+    if(field > 0){
+        while(1){
+            while(c < end && (*c == ' ' || *c == '\t')){
+                ++c;
+            }
+            if(--field == 0 || c == end){
+                break;
+            }
+            while(c < end && *c != ' ' && *c != '\t'){
+                ++c;
+            }
+        }
+        for(; c < end && *c != ' ' && *c != '\t'; ++c){
+            hash = (hash ^ (unsigned char)*c) * 16777619UL;
+        }
+        return hash;
+    }
+    
+    for(; c < end; ++c){
+        hash = (hash ^ (unsigned char)*c) * 16777619UL;
+    }
+    return hash;
+}
+
+
+
+
+/*
+ Creates an anonymous temporary file for buffering command output and returns its
+ descriptor, or -1 on failure. The file is removed as soon as it is closed. The
+ descriptor is close-on-exec, so a command only gets the scratch files dup2'd onto its
+ standard streams, not those of the other instances running beside it.
+ */
+int openScratchFile(void){
+    
+    char path[] = "/tmp/microshell-XXXXXX";
+    int fd;
+    
+    fd = mkostemp(path, O_CLOEXEC);
+    if(fd >= 0){
+        unlink(path);
+    }
+    return fd;
+}
+
+
+
+
+/*
+ Copies the full contents of the file open on fdFrom to fdTo. Returns 0 on success
+ or -1 if the copy did not complete.
+ */
+int copyFileContents(int fdFrom, int fdTo){
+    
+    char buffer[COPY_BUFFER_LEN];
+    ssize_t count;
+    
+    if(lseek(fdFrom, 0, SEEK_SET) < 0){
+        return -1;
+    }
+    
+    while((count = read(fdFrom, buffer, COPY_BUFFER_LEN)) != 0){
+        if(count < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return -1;
+        }
+        if(writeAll(fdTo, buffer, count) < 0){
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+
+
+/*
+ Writes all length bytes of data to fd, retrying short writes. Returns 0 on success
+ or -1 on error.
+ */
+int writeAll(int fd, const char *data, size_t length){
+    
+    ssize_t written;
+    
+    while(length > 0){
+        written = write(fd, data, length);
+        if(written < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return -1;
+        }
+        data += written;
+        length -= written;
+    }
+    return 0;
+}
+
+
+
+
+/*
+ Formats like printf() and writes the text to fd, so a builtin's report follows its
+ redirect. The text goes through a static buffer, since dprintf() allocates, and is cut
+ at MAX_PATH_LEN characters. Returns 0 on success or -1 on error.
+ */
+int writeFormatted(int fd, const char *format, ...){
+    
+    static char text[MAX_PATH_LEN];
+    va_list args;
+    int length;
+    
+    va_start(args, format);
+    length = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    if(length < 0){
+        return -1;
+    }
+    return writeAll(fd, text, (size_t)length < sizeof(text) ? (size_t)length : sizeof(text)-1);
+}
+
+
+
+
+/*
+ Forks like fork(), but rides out transient exhaustion of processes or memory: EAGAIN and
+ ENOMEM are retried up to FORK_RETRIES times with exponential backoff. A background job
+ that exits interrupts the backoff, so a spawn held up by the process limit is retried as
+ soon as the job scheduler frees a process. Returns -1 with errno set once the retries
+ run out, and the caller fails just that command. The child does not own the warm pool.
+ */
+pid_t forkCommand(void){
+    
+    struct timespec delay = {0, FORK_BACKOFF_MICROS * 1000L};
+    pid_t pid;
+    int attempt, error;
+    
+    
+    for(attempt=0; ; ++attempt){
+        pid = fork();
+        error = errno;
+        if(pid == 0){
+            releaseWarmPool();
+        }
+        if(pid >= 0 || (error != EAGAIN && error != ENOMEM)){
+            return pid;
+        }
+        if(attempt == FORK_RETRIES){
+            break;
+        }
+        
+        ++forkRetries;
+        nanosleep(&delay, 0);
+        delay.tv_nsec *= 2;
+    }
+    
+    ++forkFailures;
+    errno = error;
+    return -1;
+}
+
+
+
+
+/*
+ Waits for a child like waitpid() and charges the time spent blocked to the children of
+ the current line rather than to the shell. The child's CPU time and peak resident set
+ are added to the totals kept for spans. While delays are being collected, the child
+ is left a zombie until its delays have been added to the totals.
+ */
+pid_t waitForChild(pid_t pid, int *status){
+    
+    struct timespec start;
+    struct rusage usage;
+    siginfo_t info;
+    delays_t delays;
+    pid_t result;
+    int i;
+    
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if(collectingDelays && childDelays){
+        while(waitid(P_PID, pid, &info, WEXITED | WNOWAIT) < 0 && errno == EINTR);
+        readChildDelays(pid, &delays);
+        for(i=0; i < NUM_DELAYS; ++i){
+            __atomic_add_fetch(childDelays->nanos+i, delays.nanos[i], __ATOMIC_RELAXED);
+        }
+        __atomic_or_fetch(&childDelays->unknown, delays.unknown, __ATOMIC_RELAXED);
+    }
+    result = wait4(pid, status, 0, &usage);
+    childWaitMicros += microsSince(&start);
+    
+    // the usage of a child includes the descendants it waited for
+    if(result > 0){
+        childCpuMicros += (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000L +
+                          usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+        if(usage.ru_maxrss > childMaxRssKb){
+            childMaxRssKb = usage.ru_maxrss;
+        }
+    }
+    return result;
+}
+
+
+
+
+/*
+ Forks warm children until the pool holds as many as the configuration asks for, or
+ releases the extra ones after the setting was lowered. Called at startup and while the
+ shell is idle at the prompt or between schedules, so the forks happen off the path of
+ the next command.
+ */
+void fillWarmPool(void){
+    
+    int wanted = activeConfig ? activeConfig->warmChildren : 0;
+    int control[2], status;
+    pid_t pid;
+    
+    
+    while(numWarmChildren > wanted){
+        --numWarmChildren;
+        close(warmPool[numWarmChildren].controlFd); // the child exits at end of file
+        waitpid(warmPool[numWarmChildren].pid, &status, 0);
+    }
+    
+    while(numWarmChildren < wanted){
+        if(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, control) < 0){
+            fprintf(stderr, "Error! Could not create control socket for warm child: %s.\n", strerror(errno));
+            return;
+        }
+        pid = forkCommand();
+        if(pid < 0){
+            fprintf(stderr, "Error! Could not fork warm child: %s.\n", strerror(errno));
+            close(control[0]);
+            close(control[1]);
+            return;
+        }
+        if(pid == 0){
+            close(control[0]);
+            parkWarmChild(control[1]);
+        }
+    
+        close(control[1]);
+        warmPool[numWarmChildren].pid = pid;
+        warmPool[numWarmChildren].controlFd = control[0];
+        ++numWarmChildren;
+        ++warmForks;
+    }
+}
+    
+    
+    
+    
+/*
+ Closes the shell's ends of the warm children's control sockets in a forked copy of the
+ shell, which must neither hand them commands nor keep them from seeing end of file.
+ */
+void releaseWarmPool(void){
+    
+    int i;
+    
+    for(i=0; i < numWarmChildren; ++i){
+        close(warmPool[i].controlFd);
+    }
+    numWarmChildren = 0;
+}
+    
+    
+    
+    
+/*
+ Hands a command to a warm child instead of forking for it. What the child would have
+ looked up after a fork is resolved here: the program's path, an alias, the environment
+ with the trace context and overhead variables, and the resource limits. Commands that
+ need a copy of the shell rather than a program (scripts, write-back redirects and
+ arguments referring to arrays) are left to a fork, as are commands whose arguments and
+ environment do not fit in one message. Returns the child's pid, or -1 if the command
+ must be forked.
+ */
+pid_t dispatchWarmChild(const command_t *command){
+    
+    static char message[WARM_MESSAGE_LEN];
+    static char path[MAX_PATH_LEN];
+    warm_command_t *head = (warm_command_t *)message;
+    union{
+        struct cmsghdr align;
+        char buffer[CMSG_SPACE(3 * sizeof(int))];
+    } control;
+    struct msghdr header;
+    struct cmsghdr *rights;
+    struct iovec data;
+    const arg_t *alias;
+    arg_t *argList = COMMAND_ARGS(command);
+    size_t length = sizeof(warm_command_t);
+    int fds[3] = {command->fdIn, command->fdOut, fileno(stderr)};
+    int fits, status, i;
+    pid_t pid;
+    
+    
+    if(numWarmChildren == 0 || (command->fdOut != fileno(stdout) && findWriteOptions(command->fdOut))){
+        return -1;
+    }
+    for(i=0; argList[i]; ++i){
+        if(strstr(argList[i], "${")){
+            return -1;
+        }
+    }
+    
+    alias = findAlias(argList[0]);
+    if(resolveCommand(alias ? alias[0] : argList[0], path) != COMMAND_PROGRAM){
+        return -1;
+    }
+    
+    memset(head, 0, sizeof(*head));
+    fits = packString(message, &length, path);
+    for(i=0; alias && alias[i]; ++i, ++head->argc){
+        fits = fits && packString(message, &length, alias[i]);
+    }
+    for(i=alias ? 1 : 0; argList[i]; ++i, ++head->argc){
+        fits = fits && packString(message, &length, argList[i]);
+    }
+    
+    // the variables execCommand would put into the environment replace inherited ones
+    for(i=0; environ[i]; ++i){
+        if((traceFd >= 0 && strncmp(environ[i], "TRACEPARENT=", 12) == 0) ||
+           (linesRun && strncmp(environ[i], "MS_OVERHEAD_US=", 15) == 0)){
+            continue;
+        }
+        fits = fits && packString(message, &length, environ[i]);
+        ++head->envc;
+    }
+    if(traceFd >= 0){
+        fits = fits && packString(message, &length, childTraceParent);
+        ++head->envc;
+    }
+    if(linesRun){
+        fits = fits && packString(message, &length, overheadEnv);
+        ++head->envc;
+    }
+    if(!fits){
+        return -1;
+    }
+    
+    if(activeConfig){
+        head->numLimits = activeConfig->numLimits;
+        memcpy(head->limitResource, activeConfig->limitResource, sizeof(head->limitResource));
+        memcpy(head->limitValue, activeConfig->limitValue, sizeof(head->limitValue));
+    }
+    
+    
+    memset(&header, 0, sizeof(header));
+    data.iov_base = message;
+    data.iov_len = length;
+    header.msg_iov = &data;
+    header.msg_iovlen = 1;
+    header.msg_control = control.buffer;
+    header.msg_controllen = sizeof(control.buffer);
+    rights = CMSG_FIRSTHDR(&header);
+    rights->cmsg_level = SOL_SOCKET;
+    rights->cmsg_type = SCM_RIGHTS;
+    rights->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(rights), fds, sizeof(fds));
+    
+    // a child that died while parked is reaped and the next one is tried
+    while(numWarmChildren > 0){
+        --numWarmChildren;
+        pid = warmPool[numWarmChildren].pid;
+        if(sendmsg(warmPool[numWarmChildren].controlFd, &header, MSG_NOSIGNAL) == (ssize_t)length){
+            close(warmPool[numWarmChildren].controlFd);
+            ++warmDispatches;
+            return pid;
+        }
+        close(warmPool[numWarmChildren].controlFd);
+        waitpid(pid, &status, 0);
+    }
+    return -1;
+}
+    
+    
+    
+    
+/*
+ Appends text and its terminating null to the message in buffer, which holds length
+ bytes. Returns 0 if it does not fit in WARM_MESSAGE_LEN bytes.
+ */
+int packString(char *buffer, size_t *length, const char *text){
+    
+    size_t size = strlen(text)+1;
+    
+    if(*length+size > WARM_MESSAGE_LEN){
+        return 0;
+    }
+    memcpy(buffer+*length, text, size);
+    *length += size;
+    return 1;
+}
+    
+    
+    
+    
+/*
+ Runs a warm child. It resets the signals the shell handles and ignores the terminal's
+ interrupts, so that a ^C meant for a running command does not empty the pool. It then
+ waits on the control socket. When a command arrives, the child takes its standard
+ streams, resource limits and signal dispositions and execs it. It exits if the shell
+ closes the socket. Never returns.
+ */
+void parkWarmChild(int controlFd){
+    
+    static char message[WARM_MESSAGE_LEN];
+    static const int parkedSignals[] = {SIGINT, SIGQUIT, SIGTSTP};
+    struct sigaction ignore, saved[3];
+    const warm_command_t *head = (const warm_command_t *)message;
+    union{
+        struct cmsghdr align;
+        char buffer[CMSG_SPACE(3 * sizeof(int))];
+    } control;
+    struct msghdr header;
+    struct cmsghdr *rights;
+    struct iovec data;
+    char **argv, **envp, *text, *path;
+    int fds[3];
+    ssize_t length;
+    int i;
+    
+    
+    signal(SIGHUP, SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+    memset(&ignore, 0, sizeof(ignore));
+    ignore.sa_handler = SIG_IGN;
+    for(i=0; i < 3; ++i){
+        sigaction(parkedSignals[i], &ignore, saved+i);
+    }
+    
+    memset(&header, 0, sizeof(header));
+    data.iov_base = message;
+    data.iov_len = sizeof(message);
+    header.msg_iov = &data;
+    header.msg_iovlen = 1;
+    header.msg_control = control.buffer;
+    header.msg_controllen = sizeof(control.buffer);
+    while((length = recvmsg(controlFd, &header, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR);
+    
+    rights = length > 0 ? CMSG_FIRSTHDR(&header) : 0;
+    if(length < (ssize_t)sizeof(warm_command_t) || !rights || rights->cmsg_type != SCM_RIGHTS ||
+       rights->cmsg_len != CMSG_LEN(sizeof(fds))){
+        _exit(0); // the shell went away
+    }
+    memcpy(fds, CMSG_DATA(rights), sizeof(fds));
+    
+    // the child may allocate, it is about to be replaced
+    argv = malloc((head->argc+1) * sizeof(char *));
+    envp = malloc((head->envc+1) * sizeof(char *));
+    path = message+sizeof(warm_command_t);
+    text = path+strlen(path)+1;
+    for(i=0; i < head->argc; ++i, text += strlen(text)+1){
+        argv[i] = text;
+    }
+    argv[head->argc] = 0;
+    for(i=0; i < head->envc; ++i, text += strlen(text)+1){
+        envp[i] = text;
+    }
+    envp[head->envc] = 0;
+    
+    for(i=0; i < 3; ++i){
+        dup2(fds[i], i);
+        if(fds[i] > 2){
+            close(fds[i]);
+        }
+        sigaction(parkedSignals[i], saved+i, 0);
+    }
+    for(i=0; i < head->numLimits; ++i){
+        setrlimit(head->limitResource[i], head->limitValue+i);
+    }
+    
+    PROBE1(exec__begin, argv[0]);
+    execve(path, argv, envp);
+    PROBE2(exec__fail, argv[0], errno);
+    
+    fprintf(stderr, "Error! The command '%s' could not be found.\n", argv[0]);
+    _exit(1);
+}
+
+
+
+
+/*
+ Returns the microseconds elapsed on the monotonic clock since start.
+ */
+long microsSince(const struct timespec *start){
+    
+    struct timespec now;
+    
+    
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000L + (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+
+
+
+/*
+ Charges a finished line to the session: its overhead is the wall time the shell spent on
+ it (parsing, opening redirects, forking and reaping, builtins) minus the time it spent
+ waiting for children. The overhead is handed to later commands as $MS_OVERHEAD_US.
+ */
+void accountLine(const struct timespec *lineStart, long parseMicros){
+    
+    long overhead = microsSince(lineStart) - childWaitMicros;
+    
+    
+    ++linesRun;
+    overheadTotalMicros += overhead;
+    parseTotalMicros += parseMicros;
+    childTotalMicros += childWaitMicros;
+    if(overhead > overheadMaxMicros){
+        overheadMaxMicros = overhead;
+    }
+    
+    snprintf(overheadEnv, sizeof(overheadEnv), "MS_OVERHEAD_US=%ld", overhead);
+}
+
+
+
+
+/*
+ The overhead builtin. Prints the shell's overhead on the last line and its totals for
+ the session, next to the time spent waiting for children, and how much the warm pool
+ was used, on fdOut.
+ */
+int showOverhead(int fdOut){
+    
+    if(linesRun){
+        writeFormatted(fdOut, "last line %s us\n", overheadEnv+15);
+    }
+    writeFormatted(fdOut, "lines %ld, overhead total %ld us, avg %ld us, max %ld us, parsing %ld us, children %ld us\n",
+                   linesRun, overheadTotalMicros, linesRun ? overheadTotalMicros / linesRun : 0,
+                   overheadMaxMicros, parseTotalMicros, childTotalMicros);
+    if(warmForks){
+        writeFormatted(fdOut, "warm pool %d parked, %ld commands dispatched, %ld children forked\n",
+                       numWarmChildren, warmDispatches, warmForks);
+    }
+    
+    return 0;
+}
+
+
+
+
+/*
+ Sets up the totals of the delays of waited for children the first time they are needed.
+ They live in a shared mapping, so children waited for by forked shells (pipeline stages,
+ background jobs) are counted as well. The taskstats interface is used if the shell may
+ query it, which takes CAP_NET_ADMIN; otherwise delays are read from /proc. Returns 0 if
+ the totals could not be set up.
+ */
+int enableDelayAccounting(void){
+    
+    static char reply[NETLINK_BUFFER_LEN];
+    struct taskstats stats;
+    const struct nlattr *attribute;
+    char setting = '0';
+    int fd, length;
+    
+    
+    if(childDelays){
+        return 1;
+    }
+    childDelays = mmap(0, sizeof(delays_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(childDelays == MAP_FAILED){
+        childDelays = 0;
+        fprintf(stderr, "Error! Could not set up delay accounting: %s.\n", strerror(errno));
+        return 0;
+    }
+    
+    // without kernel.task_delayacct only the run queue delay is kept
+    fd = open("/proc/sys/kernel/task_delayacct", O_RDONLY | O_CLOEXEC);
+    if(fd >= 0){
+        delayAccountingOn = read(fd, &setting, 1) == 1 && setting == '1';
+        close(fd);
+    }
+    
+    taskstatsFd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+    taskstatsOwner = getpid();
+    length = taskstatsFd < 0 ? -1 : requestGenetlink(GENL_ID_CTRL, CTRL_CMD_GETFAMILY, CTRL_ATTR_FAMILY_NAME,
+                                                      TASKSTATS_GENL_NAME, sizeof(TASKSTATS_GENL_NAME), reply);
+    attribute = length > 0 ? findAttribute(reply+NLMSG_HDRLEN+GENL_HDRLEN, length-NLMSG_HDRLEN-GENL_HDRLEN,
+                                           CTRL_ATTR_FAMILY_ID) : 0;
+    if(attribute){
+        memcpy(&taskstatsFamily, (const char *)attribute+NLA_HDRLEN, sizeof(taskstatsFamily));
+    }
+    if(taskstatsFd >= 0 && (!taskstatsFamily || !queryTaskstats(getpid(), &stats))){
+        close(taskstatsFd);
+        taskstatsFd = -1;
+    }
+    return 1;
+}
+
+
+
+
+/*
+ Reads the delays of a child that has exited but not been reaped yet. The run queue delay
+ is always known; the other kinds need kernel.task_delayacct, and swap-in and reclaim
+ delays are only reported by taskstats.
+ */
+void readChildDelays(pid_t pid, delays_t *delays){
+    
+    struct taskstats stats;
+    char path[64], text[1024];
+    unsigned long long runNanos, waitNanos, ticks;
+    const char *field;
+    ssize_t length;
+    int fd, i;
+    
+    
+    memset(delays, 0, sizeof(*delays));
+    if(taskstatsFd >= 0 && queryTaskstats(pid, &stats)){
+        delays->nanos[DELAY_RUN_QUEUE] = stats.cpu_delay_total;
+        delays->nanos[DELAY_BLOCK_IO] = stats.blkio_delay_total;
+        delays->nanos[DELAY_SWAP_IN] = stats.swapin_delay_total;
+        delays->nanos[DELAY_RECLAIM] = stats.freepages_delay_total;
+    }
+    else{
+        delays->unknown = (1 << DELAY_SWAP_IN) | (1 << DELAY_RECLAIM);
+        
+        // schedstat holds the time spent running and waiting to run
+        snprintf(path, sizeof(path), "/proc/%d/schedstat", (int)pid);
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        length = fd < 0 ? -1 : read(fd, text, sizeof(text)-1);
+        text[length < 0 ? 0 : length] = 0;
+        if(sscanf(text, "%llu %llu", &runNanos, &waitNanos) == 2){
+            delays->nanos[DELAY_RUN_QUEUE] = waitNanos;
+        }
+        else{
+            delays->unknown |= 1 << DELAY_RUN_QUEUE;
+        }
+        if(fd >= 0){
+            close(fd);
+        }
+        
+        // the block I/O delay is field 42 of stat, in clock ticks; fields are counted
+        // from after the command name, which may contain spaces
+        snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        length = fd < 0 ? -1 : read(fd, text, sizeof(text)-1);
+        text[length < 0 ? 0 : length] = 0;
+        field = strrchr(text, ')');
+        for(i=2; field && i < 42; ++i){
+            field = strchr(field+1, ' ');
+        }
+        if(field && sscanf(field, "%llu", &ticks) == 1){
+            delays->nanos[DELAY_BLOCK_IO] = ticks * (1000000000ULL / sysconf(_SC_CLK_TCK));
+        }
+        else{
+            delays->unknown |= 1 << DELAY_BLOCK_IO;
+        }
+        if(fd >= 0){
+            close(fd);
+        }
+    }
+    
+    if(!delayAccountingOn){
+        delays->unknown |= (1 << DELAY_BLOCK_IO) | (1 << DELAY_SWAP_IN) | (1 << DELAY_RECLAIM);
+    }
+}
+
+
+
+
+/*
+ Asks taskstats for the statistics of a process. A forked shell opens a socket of its own
+ so that replies never reach the wrong process. Returns 1 on success or 0 on error.
+ */
+int queryTaskstats(pid_t pid, struct taskstats *stats){
+    
+    static char reply[NETLINK_BUFFER_LEN];
+    const struct nlattr *aggregate, *attribute;
+    uint32_t id = pid;
+    int length;
+    
+    
+    if(taskstatsOwner != getpid()){
+        close(taskstatsFd);
+        taskstatsFd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+        taskstatsOwner = getpid();
+    }
+    if(taskstatsFd < 0){
+        return 0;
+    }
+    
+    length = requestGenetlink(taskstatsFamily, TASKSTATS_CMD_GET, TASKSTATS_CMD_ATTR_PID, &id, sizeof(id), reply);
+    aggregate = length > 0 ? findAttribute(reply+NLMSG_HDRLEN+GENL_HDRLEN, length-NLMSG_HDRLEN-GENL_HDRLEN,
+                                           TASKSTATS_TYPE_AGGR_PID) : 0;
+    attribute = aggregate ? findAttribute((const char *)aggregate+NLA_HDRLEN, aggregate->nla_len-NLA_HDRLEN,
+                                          TASKSTATS_TYPE_STATS) : 0;
+    if(!attribute){
+        return 0;
+    }
+    
+    // older and newer kernels send shorter and longer versions of the structure
+    memset(stats, 0, sizeof(*stats));
+    length = attribute->nla_len-NLA_HDRLEN;
+    memcpy(stats, (const char *)attribute+NLA_HDRLEN, length < (int)sizeof(*stats) ? length : (int)sizeof(*stats));
+    return 1;
+}
+
+
+
+
+/*
+ Sends a generic netlink request holding a single attribute on the taskstats socket and
+ receives the reply into reply, which holds NETLINK_BUFFER_LEN bytes. Returns the length
+ of the reply, or -1 with errno set on error.
+ */
+int requestGenetlink(uint16_t family, uint8_t command, uint16_t attribute, const void *data, int length, char *reply){
+    
+    struct{
+        struct nlmsghdr header;
+        struct genlmsghdr genl;
+        char attributes[64];
+    } request;
+    struct nlattr *requestAttribute = (struct nlattr *)request.attributes;
+    struct nlmsghdr *answer = (struct nlmsghdr *)reply;
+    struct sockaddr_nl kernel;
+    ssize_t count;
+    
+    
+    memset(&request, 0, sizeof(request));
+    requestAttribute->nla_type = attribute;
+    requestAttribute->nla_len = NLA_HDRLEN + length;
+    memcpy(request.attributes+NLA_HDRLEN, data, length);
+    request.header.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN + NLA_ALIGN(requestAttribute->nla_len));
+    request.header.nlmsg_type = family;
+    request.header.nlmsg_flags = NLM_F_REQUEST;
+    request.genl.cmd = command;
+    request.genl.version = 1;
+    
+    memset(&kernel, 0, sizeof(kernel));
+    kernel.nl_family = AF_NETLINK;
+    if(sendto(taskstatsFd, &request, request.header.nlmsg_len, 0, (struct sockaddr *)&kernel, sizeof(kernel)) < 0){
+        return -1;
+    }
+    do{
+        count = recv(taskstatsFd, reply, NETLINK_BUFFER_LEN, 0);
+    } while(count < 0 && errno == EINTR);
+    
+    if(count < (ssize_t)NLMSG_HDRLEN || !NLMSG_OK(answer, (size_t)count)){
+        return -1;
+    }
+    if(answer->nlmsg_type == NLMSG_ERROR){
+        errno = -((struct nlmsgerr *)NLMSG_DATA(answer))->error;
+        return -1;
+    }
+    return answer->nlmsg_len;
+}
+
+
+
+
+/*
+ Returns the netlink attribute of the given type among the length bytes of attributes at
+ start, or 0 if there is none.
+ */
+const struct nlattr *findAttribute(const char *start, int length, int type){
+    
+    const struct nlattr *attribute;
+    
+    while(length >= NLA_HDRLEN){
+        attribute = (const struct nlattr *)start;
+        if(attribute->nla_len < NLA_HDRLEN || attribute->nla_len > length){
+            return 0;
+        }
+        if((attribute->nla_type & NLA_TYPE_MASK) == type){
+            return attribute;
+        }
+        start += NLA_ALIGN(attribute->nla_len);
+        length -= NLA_ALIGN(attribute->nla_len);
+    }
+    return 0;
+}
+
+
+
+
+/*
+ The time builtin. Usage:
+ 
+   time [-v] command [args...]
+ 
+ Runs the command and prints its wall clock, user and system time on stderr. With -v it
+ also prints how long the command's processes waited instead of running: for a CPU on
+ the run queue, for block I/O, for swap-in and for memory reclaim. Kinds of delay the
+ kernel does not keep are shown as -. Returns the command's exit status.
+ */
+int executeTimedCommand(const command_t *command){
+    
+    static const char *delayNames[NUM_DELAYS] = {"run queue", "block I/O", "swap-in", "reclaim"};
+    command_t timed = *command;
+    struct timespec start;
+    struct rusage before, after;
+    delays_t startDelays;
+    int verbose, exitStatus, i;
+    long real;
+    
+    
+    verbose = strcmp(COMMAND_ARGS(command)[1], "-v") == 0;
+    timed.argIndex += 1+verbose;
+    timed.flags = 0;
+    if(!COMMAND_ARGS(&timed)[0]){
+        fprintf(stderr, "Error! Usage: time [-v] command [args...]\n");
+        return 1;
+    }
+    if(verbose && enableDelayAccounting()){
+        ++collectingDelays;
+        startDelays = *childDelays;
+    }
+    
+    getrusage(RUSAGE_CHILDREN, &before);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    exitStatus = executeSingleCommand(&timed);
+    real = microsSince(&start);
+    getrusage(RUSAGE_CHILDREN, &after);
+    
+    fprintf(stderr, "real %ld.%03ld s, user %.3f s, sys %.3f s\n", real / 1000000, real / 1000 % 1000,
+            (after.ru_utime.tv_sec - before.ru_utime.tv_sec) + (after.ru_utime.tv_usec - before.ru_utime.tv_usec) / 1e6,
+            (after.ru_stime.tv_sec - before.ru_stime.tv_sec) + (after.ru_stime.tv_usec - before.ru_stime.tv_usec) / 1e6);
+    if(verbose && childDelays){
+        --collectingDelays;
+        fprintf(stderr, "waited:");
+        for(i=0; i < NUM_DELAYS; ++i){
+            if(childDelays->unknown & (1 << i)){
+                fprintf(stderr, "%s %s -", i ? "," : "", delayNames[i]);
+            }
+            else{
+                fprintf(stderr, "%s %s %.3f ms", i ? "," : "", delayNames[i],
+                        (childDelays->nanos[i] - startDelays.nanos[i]) / 1e6);
+            }
+        }
+        fprintf(stderr, " (%s)\n", !delayAccountingOn ? "sysctl kernel.task_delayacct=1 for the rest" :
+                                    taskstatsFd >= 0 ? "taskstats" : "/proc");
+    }
+    
+    return exitStatus;
+}
+
+
+
+
+/*
+ Replaces the current (forked) process with the given command. Array references are
+ expanded first, then the active configuration supplies the environment, any alias for
+ the command name and the resource limits. Only returns by exiting with status 1 if the
+ command could not be executed.
+ */
+void execCommand(arg_t *argList){
+    
+    char path[MAX_PATH_LEN];
+    const arg_t *alias;
+    arg_t *expanded;
+    int i, aliasLength, argCount, kind;
+    
+    argList = expandArrays(argList);
+    if(!argList[0]){
+        _exit(0); // the command expanded to nothing
+    }
+    
+    if(activeConfig){
+        for(i=0; i < activeConfig->numLimits; ++i){
+            setrlimit(activeConfig->limitResource[i], activeConfig->limitValue+i);
+        }
+        
+        alias = findAlias(argList[0]);
+        if(alias){
+            for(aliasLength=0; alias[aliasLength]; ++aliasLength);
+            for(argCount=0; argList[argCount]; ++argCount);
+            
+            // the forked child may allocate, it is about to be replaced
+            expanded = malloc((aliasLength+argCount) * sizeof(arg_t));
+            memcpy(expanded, alias, aliasLength * sizeof(arg_t));
+            memcpy(expanded+aliasLength, argList+1, argCount * sizeof(arg_t));
+            argList = expanded;
+        }
+    }
+    
+    // commands that understand trace context nest their spans under the shell's
+    if(traceFd >= 0){
+        putenv(childTraceParent);
+    }
+    if(linesRun){
+        putenv(overheadEnv); // the shell's own time on the previous line
+    }
+    
+    // a microshell script runs in this copy of the shell rather than a new interpreter
+    kind = resolveCommand(argList[0], path);
+    if(kind == COMMAND_SCRIPT){
+        _exit(runNestedScript(path, argList));
+    }
+    
+    PROBE1(exec__begin, argList[0]);
+    if(kind == COMMAND_PROGRAM){
+        execv(path, argList);
+    }
+    execvp(argList[0], argList);
+    PROBE2(exec__fail, argList[0], errno);
+    
+    // show an error if the command was not successfully exec'd
+    fprintf(stderr, "Error! The command '%s' could not be found.\n", argList[0]);
+    _exit(1);
+}
+
+
+
+
+/*
+ Returns the words an alias of the active configuration replaces name with, or 0 if
+ name is not an alias.
+ */
+const arg_t *findAlias(const char *name){
+    
+    int i;
+    
+    for(i=0; activeConfig && i < activeConfig->numAliases; ++i){
+        if(strcmp(activeConfig->aliasArgs[activeConfig->aliasStart[i]], name) == 0){
+            return activeConfig->aliasArgs+activeConfig->aliasStart[i]+1;
+        }
+    }
+    return 0;
+}
+
+
+
+
+/*
+ Looks a command name up the way execvp would, through $PATH unless it contains a slash,
+ and copies the executable it names to path. Returns COMMAND_SCRIPT if that file is a
+ microshell script: one whose #! line runs microshell, directly or through env, or a text
+ file without a #! line, which execvp would otherwise hand to /bin/sh. Returns
+ COMMAND_PROGRAM for anything else that is executable, or COMMAND_NOT_FOUND. Under the
+ cache's input tracer, which does not see access or stat, each directory entry passed
+ over is also opened with O_PATH so that it is recorded as a dependency.
+ */
+int resolveCommand(const char *name, char *path){
+    
+    const char *directory, *end, *searchPath = getenv("PATH");
+    char head[256], *interpreter, *base;
+    struct stat fileStat;
+    ssize_t length;
+    int fd;
+    
+    
+    if(strchr(name, '/')){
+        snprintf(path, MAX_PATH_LEN, "%s", name);
+        if(access(path, X_OK) < 0){
+            return COMMAND_NOT_FOUND;
+        }
+    }
+    else{
+        if(!searchPath){
+            searchPath = "/bin:/usr/bin";
+        }
+        for(directory=searchPath; ; directory=end+1){
+            end = strchrnul(directory, ':');
+            snprintf(path, MAX_PATH_LEN, "%.*s%s%s", (int)(end-directory), directory, end > directory ? "/" : "", name);
+            if(access(path, X_OK) == 0 && stat(path, &fileStat) == 0 && S_ISREG(fileStat.st_mode)){
+                break;
+            }
+            if(inputsTraced && (fd = open(path, O_PATH | O_CLOEXEC)) >= 0){
+                close(fd);
+            }
+            if(!*end){
+                return COMMAND_NOT_FOUND;
+            }
+        }
+    }
+    
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0){
+        return COMMAND_PROGRAM; // executable but not readable
+    }
+    length = read(fd, head, sizeof(head)-1);
+    close(fd);
+    if(length <= 0){
+        return COMMAND_PROGRAM;
+    }
+    head[length] = 0;
+    
+    if(head[0] != '#' || head[1] != '!'){
+        // a script without #! is text; programs have a binary header
+        return memchr(head, 0, length) || (length >= 4 && memcmp(head, "\177ELF", 4) == 0) ?
+               COMMAND_PROGRAM : COMMAND_SCRIPT;
+    }
+    
+    interpreter = strtok(head+2, " \t\r\n");
+    base = interpreter ? strrchr(interpreter, '/') : 0;
+    base = base ? base+1 : interpreter;
+    if(base && strcmp(base, "env") == 0){
+        base = strtok(0, " \t\r\n");
+    }
+    return base && strcmp(base, "microshell") == 0 ? COMMAND_SCRIPT : COMMAND_PROGRAM;
+}
+
+
+
+
+/*
+ Runs a microshell script in the forked child that would otherwise exec a new interpreter
+ for it. Returns the exit status of the script.
+ */
+int runNestedScript(const char *path, arg_t *argList){
+    
+    startNestedShell();
+    return runScript(path, argList);
+}
+
+
+
+
+/*
+ Makes a forked child a shell of its own. It keeps the configuration, compiled patterns
+ and open trace output of the shell that started it, but starts with no jobs, arrays or
+ schedules, checks allocations from its own warm-up, and records its spans under the
+ span of the command that ran it.
+ */
+void startNestedShell(void){
+    
+    int i;
+    
+    
+    for(i=0; i < MAX_JOBS; ++i){
+        if(jobs[i].state == JOB_QUEUED){
+            close(jobs[i].startFd);
+        }
+        jobs[i].state = JOB_FREE;
+    }
+    jobsStarted = jobsRejected = 0;
+    jobWaitTotalMicros = jobWaitMaxMicros = 0;
+    shellPid = getpid();
+    
+#ifdef CHECK_ALLOCATIONS
+    allocationsAllowed = 1;
+#endif
+    for(i=0; i < MAX_ARRAYS; ++i){
+        if(arrays[i].type != ARRAY_FREE){
+            clearArray(arrays+i);
+        }
+    }
+    
+    numSpans = 0;
+    spanOwner = getpid();
+    if(traceFd >= 0){
+        memcpy(traceParentSpan, childTraceParent+strlen("TRACEPARENT=00-")+33, 16);
+    }
+    
+    // the schedules and their timer stay with the shell that registered them
+    numSchedules = 0;
+    numScheduleRuns = 0;
+    if(timerFd >= 0){
+        close(timerFd);
+        timerFd = -1;
+    }
+}
+
+
+
+
+/*
+ Builds a configuration snapshot from the rc file at path without touching the active
+ one. Each non-empty line that does not start with '#' is one of:
+ 
+   NAME=value                 set an environment variable for new commands
+   alias name command [args]  replace a command name with another command line
+   limit resource value       set a resource limit (cpu, fsize, data, stack, core,
+                              nofile, nproc, as, memlock) or "unlimited" for new commands
+   jobs slots queue           run at most slots background jobs at once and hold at
+                              most queue more waiting for a slot
+   pool children              keep up to 16 children forked ahead of time to run
+                              commands in
+ 
+ A missing file yields an empty snapshot. Returns 0 if the file has errors, could not be
+ read in full (as when an editor rewrites it during a reload) or there is no memory for
+ it, in which case the error is reported and nothing is allocated.
+ */
+config_t *loadConfig(const char *path){
+    
+    static const char *limitNames[] = {"cpu", "fsize", "data", "stack", "core",
+                                       "nofile", "nproc", "as", "memlock"};
+    static const int limitResources[] = {RLIMIT_CPU, RLIMIT_FSIZE, RLIMIT_DATA, RLIMIT_STACK, RLIMIT_CORE,
+                                         RLIMIT_NOFILE, RLIMIT_NPROC, RLIMIT_AS, RLIMIT_MEMLOCK};
+    config_t *config;
+    struct stat fileStat;
+    char *line, *lineEnd, *c, *equals;
+    char **env;
+    arg_t *words;
+    int fd, numEnv, numWords, wordCount, baseCount, lineNumber, i;
+    size_t nameLength;
+    off_t length = 0;
+    ssize_t got;
+    
+    
+    config = calloc(1, sizeof(config_t));
+    if(!config){
+        fprintf(stderr, "Error! Not enough memory to load '%s'.\n", path);
+        return 0;
+    }
+    fd = open(path, O_RDONLY);
+    if(fd >= 0 && fstat(fd, &fileStat) == 0){
+        config->text = malloc(fileStat.st_size+1);
+        while(config->text && length < fileStat.st_size){
+            got = read(fd, config->text+length, fileStat.st_size-length);
+            if(got < 0 && errno == EINTR){
+                continue;
+            }
+            if(got <= 0){
+                break;
+            }
+            length += got;
+        }
+        if(config->text && length < fileStat.st_size){
+            fprintf(stderr, "Error! Could not read all of '%s'.\n", path);
+            close(fd);
+            freeConfig(config);
+            return 0;
+        }
+    }
+    else{
+        config->text = malloc(1);
+    }
+    if(fd >= 0){
+        close(fd);
+    }
+    if(!config->text){
+        fprintf(stderr, "Error! Not enough memory to load '%s'.\n", path);
+        freeConfig(config);
+        return 0;
+    }
+    config->text[length] = 0;
+    
+    // size the vectors generously: each word can be at most one entry
+    for(baseCount=0; baseEnviron[baseCount]; ++baseCount);
+    for(numWords=1, c=config->text; *c; ++c){
+        numWords += (*c == '\n' || ISWHITESPACE(*c));
+    }
+    config->envp = malloc((baseCount+numWords+1) * sizeof(char *));
+    config->aliasArgs = malloc((numWords*2) * sizeof(arg_t));
+    if(!config->envp || !config->aliasArgs){
+        fprintf(stderr, "Error! Not enough memory to load '%s'.\n", path);
+        freeConfig(config);
+        return 0;
+    }
+    numEnv = 0;
+    numWords = 0;
+    
+    
+    for(line=config->text, lineNumber=1; *line; line=lineEnd, ++lineNumber){
+        lineEnd = strchr(line, '\n');
+        if(lineEnd){
+            *(lineEnd++) = 0;
+        }
+        else{
+            lineEnd = line+strlen(line);
+        }
+        
+        while(ISWHITESPACE(*line)){
+            ++line;
+        }
+        for(c=line+strlen(line); c > line && ISWHITESPACE(*(c-1)); --c){
+            *(c-1) = 0;
+        }
+        if(*line == 0 || *line == '#'){
+            continue;
+        }
+        
+        equals = strchr(line, '=');
+        for(c=line; c < equals && (*c == '_' || (*c >= 'A' && *c <= 'Z') || (*c >= 'a' && *c <= 'z') ||
+                                   (c > line && *c >= '0' && *c <= '9')); ++c);
+        if(equals && c == equals && c > line){
+            config->envp[baseCount+numEnv++] = line;
+            continue;
+        }
+        
+        // split the line into words in place
+        words = config->aliasArgs+numWords;
+        wordCount = 0;
+        for(c=line; *c; ){
+            words[wordCount++] = c;
+            while(*c && !ISWHITESPACE(*c)){
+                ++c;
+            }
+            while(ISWHITESPACE(*c)){
+                *(c++) = 0;
+            }
+        }
+        
+        if(strcmp(words[0], "alias") == 0 && wordCount >= 3 && config->numAliases < MAX_CONFIG_ALIASES){
+            config->aliasStart[config->numAliases++] = numWords;
+            memmove(words, words+1, (wordCount-1) * sizeof(arg_t));
+            words[wordCount-1] = 0;
+            numWords += wordCount;
+            continue;
+        }
+        
+        if(strcmp(words[0], "limit") == 0 && wordCount == 3 && config->numLimits < MAX_CONFIG_LIMITS){
+            for(i=0; i < (int)(sizeof(limitNames) / sizeof(limitNames[0])); ++i){
+                if(strcmp(words[1], limitNames[i]) == 0){
+                    break;
+                }
+            }
+            if(i < (int)(sizeof(limitNames) / sizeof(limitNames[0]))){
+                config->limitResource[config->numLimits] = limitResources[i];
+                config->limitValue[config->numLimits].rlim_cur = strcmp(words[2], "unlimited") == 0 ?
+                    RLIM_INFINITY : strtoul(words[2], 0, 10);
+                config->limitValue[config->numLimits].rlim_max = config->limitValue[config->numLimits].rlim_cur;
+                ++config->numLimits;
+                continue;
+            }
+        }
+        
+        if(strcmp(words[0], "jobs") == 0 && wordCount == 3 && atoi(words[1]) > 0 && atoi(words[2]) >= 0){
+            config->jobSlots = atoi(words[1]);
+            config->jobQueue = atoi(words[2]);
+            continue;
+        }
+        
+        if(strcmp(words[0], "pool") == 0 && wordCount == 2 && atoi(words[1]) >= 0){
+            config->warmChildren = atoi(words[1]) < MAX_WARM_CHILDREN ? atoi(words[1]) : MAX_WARM_CHILDREN;
+            continue;
+        }
+        
+        fprintf(stderr, "Error! Unrecognized setting on line %d of '%s'.\n", lineNumber, path);
+        freeConfig(config);
+        return 0;
+    }
+    
+    
+    // inherited variables come first unless the rc file overrides them
+    env = config->envp;
+    for(i=0; i < baseCount; ++i){
+        equals = strchr(baseEnviron[i], '=');
+        nameLength = equals ? (size_t)(equals-baseEnviron[i])+1 : strlen(baseEnviron[i]);
+        for(fd=0; fd < numEnv; ++fd){
+            if(strncmp(config->envp[baseCount+fd], baseEnviron[i], nameLength) == 0){
+                break;
+            }
+        }
+        if(fd == numEnv){
+            *(env++) = baseEnviron[i];
+        }
+    }
+    memmove(env, config->envp+baseCount, numEnv * sizeof(char *));
+    env[numEnv] = 0;
+    
+    return config;
+}
+
+
+
+
+/*
+ Releases a configuration snapshot. Accepts 0.
+ */
+void freeConfig(config_t *config){
+    
+    if(config){
+        free(config->text);
+        free(config->envp);
+        free(config->aliasArgs);
+        free(config);
+    }
+}
+
+
+
+
+/*
+ Builds a new configuration snapshot from $MICROSHELLRC (or ~/.microshellrc) and
+ publishes it by swapping the active pointer and the environment. Commands that are
+ already running keep the settings they were started with. The replaced snapshot is
+ retired rather than freed, and released once the current line has finished. Returns
+ 1 on success or 0 if the active configuration was kept.
+ */
+int reloadConfig(void){
+    
+    char path[MAX_PATH_LEN];
+    config_t *config;
+    
+    if(getenv("MICROSHELLRC")){
+        snprintf(path, MAX_PATH_LEN, "%s", getenv("MICROSHELLRC"));
+    }
+    else{
+        snprintf(path, MAX_PATH_LEN, "%s/.microshellrc", getenv("HOME") ? getenv("HOME") : "");
+    }
+    
+    config = loadConfig(path);
+    if(!config){
+        return 0;
+    }
+    
+    freeConfig(retiredConfig);
+    retiredConfig = activeConfig;
+    activeConfig = config;
+    environ = config->envp;
+    return 1;
+}
+
+
+
+
+/*
+ Signal handler for SIGHUP. Marks the configuration for reloading before the next line,
+ or as soon as the shell wakes up while it waits for input or serves schedules.
+ */
+void requestReload(int sig){
+    
+    (void)sig;
+    reloadRequested = 1;
+}
+
+
+
+
+/*
+ Starts a new configuration epoch while no line is running: releases the snapshot retired
+ during the last line and publishes a reload requested since.
+ */
+void applyPendingReload(void){
+    
+    ALLOW_ALLOCATIONS(1);
+    freeConfig(retiredConfig);
+    retiredConfig = 0;
+    if(reloadRequested){
+        reloadRequested = 0;
+        reloadConfig();
+    }
+    ALLOW_ALLOCATIONS(0);
+}
+
+
+
+
+/*
+ Runs a command chain ending in & as a background job and returns immediately. The job
+ is forked right away but waits on its start pipe until a job slot is free, so queued
+ jobs keep the chain the shell already parsed. When every slot is busy and the queue is
+ full the job is refused at once instead of letting the queue grow. Returns 0 if the
+ job was accepted or 1 if it was refused. The parameter *commandCount returns the total
+ number of commands in the chain.
+ */
+int submitBackgroundJob(const command_t *chain, int *commandCount){
+    
+    const command_t *com;
+    int startPipe[2];
+    int slots, queue, active = 0, free = -1;
+    sigset_t childMask, oldMask;
+    pid_t pid = -1;
+    ssize_t count;
+    struct timespec submitted;
+    char go;
+    int i, status;
+    
+    
+    *commandCount = 0;
+    for(com=chain; com; com=NEXT_COMMAND(com)){
+        ++(*commandCount);
+    }
+    getJobLimits(&slots, &queue);
+    
+    sigemptyset(&childMask);
+    sigaddset(&childMask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &childMask, &oldMask);
+    
+    for(i=0; i < MAX_JOBS; ++i){
+        if(jobs[i].state == JOB_QUEUED || jobs[i].state == JOB_RUNNING){
+            ++active;
+        }
+        else if(jobs[i].state == JOB_FREE && free < 0){
+            free = i;
+        }
+    }
+    
+    if(active >= slots+queue || free < 0){
+        ++jobsRejected;
+        sigprocmask(SIG_SETMASK, &oldMask, 0);
+        fprintf(stderr, "Error! Too many background jobs, try again later.\n");
+    }
+    else if(pipe2(startPipe, O_CLOEXEC) < 0){
+        sigprocmask(SIG_SETMASK, &oldMask, 0);
+        fprintf(stderr, "Error! Could not create pipe for background job.\n");
+    }
+    else if((pid = forkCommand()) < 0){
+        sigprocmask(SIG_SETMASK, &oldMask, 0);
+        fprintf(stderr, "Error! Could not fork process for background job: %s.\n", strerror(errno));
+        close(startPipe[0]);
+        close(startPipe[1]);
+    }
+    else if(pid == 0){
+        signal(SIGCHLD, SIG_DFL);
+        sigprocmask(SIG_SETMASK, &oldMask, 0);
+        close(startPipe[1]);
+        for(i=0; i < MAX_JOBS; ++i){
+            if(jobs[i].state == JOB_QUEUED){
+                close(jobs[i].startFd);
+            }
+        }
+        clock_gettime(CLOCK_REALTIME, &submitted);
+        jobSubmittedNanos = submitted.tv_sec * 1000000000ULL + submitted.tv_nsec;
+        
+        // wait for a slot; end of file means the shell went away while queued
+        while((count = read(startPipe[0], &go, 1)) < 0 && errno == EINTR);
+        if(count != 1){
+            _exit(1);
+        }
+        close(startPipe[0]);
+        
+        // the job exports its own spans
+        numSpans = 0;
+        spanOwner = getpid();
+        status = executeCommandChain(chain, &i);
+        flushSpans();
+        _exit(status);
+    }
+    
+    
+    // the job has its own copies of any redirected files
+    for(com=chain; com; com=NEXT_COMMAND(com)){
+        if(com->fdIn != fileno(stdin)){
+            close(com->fdIn);
+        }
+        if(com->fdOut != fileno(stdout)){
+            close(com->fdOut);
+        }
+    }
+    
+    if(pid < 0){
+        return 1;
+    }
+    
+    close(startPipe[0]);
+    jobs[free].id = free+1;
+    jobs[free].state = JOB_QUEUED;
+    jobs[free].pid = pid;
+    jobs[free].startFd = startPipe[1];
+    jobs[free].exitStatus = 0;
+    jobs[free].sequence = jobSequence++;
+    jobs[free].waitMicros = 0;
+    clock_gettime(CLOCK_MONOTONIC, &jobs[free].queuedAt);
+    
+    startQueuedJobs();
+    printf("[%d] %d%s\n", jobs[free].id, (int)pid, jobs[free].state == JOB_QUEUED ? " (queued)" : "");
+    fflush(stdout);
+    
+    sigprocmask(SIG_SETMASK, &oldMask, 0);
+    return 0;
+}
+
+
+
+
+/*
+ Gives free job slots to queued jobs in the order they were submitted and records how
+ long each one waited. Called with SIGCHLD blocked or from its handler, so it only uses
+ async-signal-safe calls.
+ */
+void startQueuedJobs(void){
+    
+    int slots, queue, running = 0, next, i;
+    struct timespec now;
+    char go = 1;
+    
+    getJobLimits(&slots, &queue);
+    for(i=0; i < MAX_JOBS; ++i){
+        running += (jobs[i].state == JOB_RUNNING);
+    }
+    
+    while(running < slots){
+        next = -1;
+        for(i=0; i < MAX_JOBS; ++i){
+            if(jobs[i].state == JOB_QUEUED && (next < 0 || jobs[i].sequence < jobs[next].sequence)){
+                next = i;
+            }
+        }
+        if(next < 0){
+            break;
+        }
+        
+        write(jobs[next].startFd, &go, 1);
+        close(jobs[next].startFd);
+        jobs[next].state = JOB_RUNNING;
+        ++running;
+        
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        jobs[next].waitMicros = (now.tv_sec - jobs[next].queuedAt.tv_sec) * 1000000L +
+                                (now.tv_nsec - jobs[next].queuedAt.tv_nsec) / 1000;
+        ++jobsStarted;
+        jobWaitTotalMicros += jobs[next].waitMicros;
+        if(jobs[next].waitMicros > jobWaitMaxMicros){
+            jobWaitMaxMicros = jobs[next].waitMicros;
+        }
+    }
+}
+
+
+
+
+/*
+ Signal handler for SIGCHLD. Reaps finished background jobs and schedule runs without
+ touching foreground children, then starts queued jobs in the freed slots. Forked copies
+ of the shell ignore it since the job table belongs to the shell process.
+ */
+void reapBackgroundJobs(int sig){
+    
+    int savedErrno = errno;
+    int status, i;
+    
+    (void)sig;
+    if(getpid() != shellPid){
+        return;
+    }
+    
+    for(i=0; i < MAX_JOBS; ++i){
+        if((jobs[i].state == JOB_RUNNING || jobs[i].state == JOB_QUEUED) &&
+           waitpid(jobs[i].pid, &status, WNOHANG) == jobs[i].pid){
+            if(jobs[i].state == JOB_QUEUED){
+                close(jobs[i].startFd);
+            }
+            PROBE2(child__reaped, jobs[i].pid, status);
+            jobs[i].state = JOB_DONE;
+            jobs[i].exitStatus = WIFEXITED(status) ? WEXITSTATUS(status) : 128+WTERMSIG(status);
+        }
+    }
+    startQueuedJobs();
+    
+    for(i=0; i < numScheduleRuns; ){
+        if(waitpid(scheduleRuns[i].pid, &status, WNOHANG) != scheduleRuns[i].pid){
+            ++i;
+            continue;
+        }
+        PROBE2(child__reaped, scheduleRuns[i].pid, status);
+        if(scheduleRuns[i].schedule >= 0){
+            --schedules[scheduleRuns[i].schedule].running;
+            schedules[scheduleRuns[i].schedule].lastStatus = WIFEXITED(status) ? WEXITSTATUS(status) : 128+WTERMSIG(status);
+        }
+        scheduleRuns[i] = scheduleRuns[--numScheduleRuns];
+    }
+    
+    errno = savedErrno;
+}
+
+
+
+
+/*
+ Prints and releases background jobs that have finished since the last prompt.
+ */
+void reportFinishedJobs(void){
+    
+    sigset_t childMask, oldMask;
+    int i;
+    
+    sigemptyset(&childMask);
+    sigaddset(&childMask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &childMask, &oldMask);
+    
+    for(i=0; i < MAX_JOBS; ++i){
+        if(jobs[i].state == JOB_DONE){
+            printf("[%d] Done (exit status %d)\n", jobs[i].id, jobs[i].exitStatus);
+            jobs[i].state = JOB_FREE;
+        }
+    }
+    
+    sigprocmask(SIG_SETMASK, &oldMask, 0);
+}
+
+
+
+
+/*
+ The jobs builtin. Lists the active background jobs with the time each waited for a
+ slot, followed by the queue limits and wait time totals for the session, on fdOut.
+ */
+int listJobs(int fdOut){
+    
+    static const char *stateNames[] = {"free", "queued", "running", "done"};
+    sigset_t childMask, oldMask;
+    int slots, queue, i;
+    
+    sigemptyset(&childMask);
+    sigaddset(&childMask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &childMask, &oldMask);
+    
+    getJobLimits(&slots, &queue);
+    for(i=0; i < MAX_JOBS; ++i){
+        if(jobs[i].state != JOB_FREE){
+            writeFormatted(fdOut, "[%d] %d %s, waited %ld us\n", jobs[i].id, (int)jobs[i].pid,
+                           stateNames[jobs[i].state], jobs[i].waitMicros);
+        }
+    }
+    writeFormatted(fdOut, "slots %d, queue %d, started %ld, refused %ld, wait avg %ld us, max %ld us\n",
+                   slots, queue, jobsStarted, jobsRejected,
+                   jobsStarted ? jobWaitTotalMicros / jobsStarted : 0, jobWaitMaxMicros);
+    writeFormatted(fdOut, "fork retries %ld, fork failures %ld\n", forkRetries, forkFailures);
+    
+    sigprocmask(SIG_SETMASK, &oldMask, 0);
+    return 0;
+}
+
+
+
+
+/*
+ Returns the number of job slots and the queue bound from the active configuration,
+ defaulting to one slot per online CPU and a queue of DEFAULT_JOB_QUEUE.
+ */
+void getJobLimits(int *slots, int *queue){
+    
+    *slots = activeConfig && activeConfig->jobSlots ? activeConfig->jobSlots : defaultJobSlots;
+    *queue = activeConfig && activeConfig->jobSlots ? activeConfig->jobQueue : DEFAULT_JOB_QUEUE;
+    
+    if(*slots < 1){
+        *slots = 1;
+    }
+    if(*slots > MAX_JOBS){
+        *slots = MAX_JOBS;
+    }
+    if(*queue > MAX_JOBS-*slots){
+        *queue = MAX_JOBS-*slots;
+    }
+}
+
+
+
+
+/*
+ The every and at builtins. Usage:
+ 
+   every interval [-s] [-j jitter] [--] command [args...]
+   at hh:mm[:ss] [-s] [-j jitter] [--] command [args...]
+   every | at                 list the schedules on fdOut
+   every -r id | at -r id     remove a schedule
+ 
+ every runs the command line once per interval (a number with ms, s, m, h or d, seconds
+ by default), first one interval from now; at runs it every day at the given local time.
+ The words of the command are joined into a line that is parsed afresh for every run in a
+ fork of the shell, so a quoted command may hold pipes, redirects and chains. Runs keep
+ to the timeline they started on however late one of them starts, and runs that could
+ not start in time are counted as missed rather than started late in a burst. -s skips
+ a run while the previous one is still going, and -j delays each run by a random time
+ of up to jitter without moving the timeline. Returns the exit status of the builtin.
+ */
+int defineSchedule(arg_t *argList, int kind, int fdOut){
+    
+    const char *name = kind == SCHEDULE_EVERY ? "every" : "at";
+    schedule_t *schedule;
+    long interval = 0, jitter = 0;
+    int hour = 0, minute = 0, second = 0, flags = 0, index, i;
+    size_t length = 0;
+    char end;
+    
+    
+    if(!argList[0]){
+        return listSchedules(kind, fdOut);
+    }
+    if(getpid() != scheduleOwner){
+        fprintf(stderr, "Error! %s only registers schedules in the top-level shell.\n", name);
+        return 1;
+    }
+    if(strcmp(argList[0], "-r") == 0){
+        index = argList[1] ? atoi(argList[1])-1 : -1;
+        if(index < 0 || index >= MAX_SCHEDULES || schedules[index].kind != kind){
+            fprintf(stderr, "Error! There is no schedule '%s' to remove.\n", argList[1] ? argList[1] : "");
+            return 1;
+        }
+        removeSchedule(index);
+        return 0;
+    }
+    
+    if(kind == SCHEDULE_EVERY){
+        interval = parseDuration(argList[0]);
+    }
+    else if((sscanf(argList[0], "%d:%d%c", &hour, &minute, &end) == 2 ||
+             (sscanf(argList[0], "%d:%d:%d%c", &hour, &minute, &second, &end) == 3)) &&
+            hour >= 0 && hour < 24 && minute >= 0 && minute < 60 && second >= 0 && second < 60){
+        interval = 86400000L;
+    }
+    for(i=1; interval > 0 && argList[i] && argList[i][0] == '-'; ++i){
+        if(strcmp(argList[i], "--") == 0){
+            ++i;
+            break;
+        }
+        else if(strcmp(argList[i], "-s") == 0){
+            flags |= SCHEDULE_SKIP_RUNNING;
+        }
+        else if(strcmp(argList[i], "-j") == 0 && argList[i+1]){
+            jitter = parseDuration(argList[++i]);
+            interval = jitter > 0 && jitter < interval ? interval : -1;
+        }
+        else{
+            interval = -1;
+        }
+    }
+    if(interval <= 0 || !argList[i]){
+        fprintf(stderr, "Error! Usage: %s %s [-s] [-j jitter] [--] command [args...]\n", name,
+                kind == SCHEDULE_EVERY ? "interval" : "hh:mm[:ss]");
+        return 1;
+    }
+    
+    for(index=0; index < MAX_SCHEDULES && schedules[index].kind != SCHEDULE_FREE; ++index);
+    if(index == MAX_SCHEDULES || (timerFd < 0 && !startTimerWheel())){
+        fprintf(stderr, "Error! Could not register another schedule.\n");
+        return 1;
+    }
+    schedule = schedules+index;
+    memset(schedule, 0, sizeof(*schedule));
+    for(; argList[i]; ++i){
+        length += snprintf(schedule->command+length, length < MAX_SCHEDULE_LEN ? MAX_SCHEDULE_LEN-length : 0,
+                           "%s%s", length ? " " : "", argList[i]);
+    }
+    if(length >= MAX_SCHEDULE_LEN){
+        fprintf(stderr, "Error! The command is longer than %d characters.\n", MAX_SCHEDULE_LEN-1);
+        return 1;
+    }
+    
+    // catch the wheel up first so that new schedules are placed relative to now
+    advanceTimerWheel();
+    schedule->kind = kind;
+    schedule->flags = flags;
+    schedule->interval = (interval + TICK_MILLIS-1) / TICK_MILLIS;
+    schedule->jitter = jitter / TICK_MILLIS;
+    schedule->secondOfDay = hour*3600 + minute*60 + second;
+    schedule->nominal = kind == SCHEDULE_EVERY ? wheelTick + schedule->interval : nextDailyTick(schedule->secondOfDay);
+    schedule->due = schedule->nominal + (schedule->jitter ? (uint64_t)random() % (schedule->jitter+1) : 0);
+    insertSchedule(index);
+    if(numSchedules++ == 0){
+        startTimerWheel(); // rearm the timer
+    }
+    
+    writeFormatted(fdOut, "[%d] %s\n", index+1, schedule->command);
+    return 0;
+}
+
+
+
+
+/*
+ Parses a positive duration: a number followed by ms, s, m, h or d, or by nothing for
+ seconds. Returns it in milliseconds, or -1 if it is not a duration.
+ */
+long parseDuration(const char *text){
+    
+    static const char *units[] = {"ms", "s", "m", "h", "d", ""};
+    static const double millis[] = {1, 1000, 60000, 3600000, 86400000, 1000};
+    char *end;
+    double value = strtod(text, &end);
+    int i;
+    
+    for(i=0; i < 6; ++i){
+        if(strcmp(end, units[i]) == 0){
+            return end > text && value > 0 && value*millis[i] < 1e15 ? (long)(value*millis[i]) : -1;
+        }
+    }
+    return -1;
+}
+
+
+
+
+/*
+ Lists the schedules of a kind with the time until their next run, how often they ran, were
+ skipped because the last run was still going or missed while the shell was busy, and
+ the exit status of the last run that finished. The list is written to fdOut.
+ */
+int listSchedules(int kind, int fdOut){
+    
+    sigset_t childMask, oldMask;
+    schedule_t *schedule;
+    int i;
+    
+    sigemptyset(&childMask);
+    sigaddset(&childMask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &childMask, &oldMask);
+    
+    if(numSchedules > 0){
+        advanceTimerWheel();
+    }
+    for(i=0; i < MAX_SCHEDULES; ++i){
+        schedule = schedules+i;
+        if(schedule->kind != kind){
+            continue;
+        }
+        if(kind == SCHEDULE_EVERY){
+            writeFormatted(fdOut, "[%d] every %.1f s", i+1, schedule->interval * TICK_MILLIS / 1000.0);
+        }
+        else{
+            writeFormatted(fdOut, "[%d] at %02d:%02d:%02d", i+1, schedule->secondOfDay / 3600,
+                           schedule->secondOfDay / 60 % 60, schedule->secondOfDay % 60);
+        }
+        writeFormatted(fdOut, "%s, next in %.1f s, runs %ld, skipped %ld, missed %ld, running %d, last status %d: %s\n",
+                       schedule->flags & SCHEDULE_SKIP_RUNNING ? " -s" : "",
+                       (schedule->due - wheelTick) * TICK_MILLIS / 1000.0, schedule->runs, schedule->skipped,
+                       schedule->missed, schedule->running, schedule->lastStatus, schedule->command);
+    }
+    
+    sigprocmask(SIG_SETMASK, &oldMask, 0);
+    return 0;
+}
+
+
+
+
+/*
+ Removes a schedule. Its runs that are still going are left to finish and reaped as
+ usual. The timer is stopped with the last schedule, so an idle shell is not woken.
+ */
+void removeSchedule(int index){
+    
+    static const struct itimerspec stopped;
+    sigset_t childMask, oldMask;
+    int i;
+    
+    sigemptyset(&childMask);
+    sigaddset(&childMask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &childMask, &oldMask);
+    
+    unlinkSchedule(index);
+    schedules[index].kind = SCHEDULE_FREE;
+    for(i=0; i < numScheduleRuns; ++i){
+        if(scheduleRuns[i].schedule == index){
+            scheduleRuns[i].schedule = -1;
+        }
+    }
+    if(--numSchedules == 0){
+        timerfd_settime(timerFd, 0, &stopped, 0);
+    }
+    
+    sigprocmask(SIG_SETMASK, &oldMask, 0);
+}
+
+
+
+
+/*
+ Arms the timer that ticks the wheel every TICK_MILLIS, creating it and the empty wheel
+ the first time. Ticks are counted from the start of the wheel on the monotonic clock,
+ so they keep their phase across rearming. Returns 0 if the timer could not be created.
+ */
+int startTimerWheel(void){
+    
+    struct itimerspec period;
+    uint64_t next;
+    int i;
+    
+    if(timerFd < 0){
+        timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if(timerFd < 0){
+            return 0;
+        }
+        for(i=0; i < WHEEL_LEVELS * WHEEL_SLOTS; ++i){
+            wheel[i] = -1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &wheelStart);
+        wheelTick = 0;
+        srandom(wheelStart.tv_nsec ^ getpid());
+        return 1;
+    }
+    
+    next = (wheelTick+1) * TICK_MILLIS;
+    period.it_value.tv_sec = wheelStart.tv_sec + next / 1000;
+    period.it_value.tv_nsec = wheelStart.tv_nsec + (next % 1000) * 1000000L;
+    if(period.it_value.tv_nsec >= 1000000000L){
+        ++period.it_value.tv_sec;
+        period.it_value.tv_nsec -= 1000000000L;
+    }
+    period.it_interval.tv_sec = TICK_MILLIS / 1000;
+    period.it_interval.tv_nsec = (TICK_MILLIS % 1000) * 1000000L;
+    return timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &period, 0) == 0;
+}
+
+
+
+
+/*
+ Returns the number of whole ticks since the wheel started.
+ */
+uint64_t currentTick(void){
+    
+    struct timespec now;
+    
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((now.tv_sec - wheelStart.tv_sec) * 1000 + (now.tv_nsec - wheelStart.tv_nsec) / 1000000) / TICK_MILLIS;
+}
+
+
+
+
+/*
+ Returns the first tick at or after the next time the local clock shows secondOfDay.
+ It is worked out from the wall clock for every run, so runs follow changes of the
+ clock and of daylight saving time.
+ */
+uint64_t nextDailyTick(int secondOfDay){
+    
+    struct timespec now;
+    struct tm local;
+    time_t target;
+    long millis;
+    int day;
+    
+    clock_gettime(CLOCK_REALTIME, &now);
+    for(day=0; ; ++day){
+        localtime_r(&now.tv_sec, &local);
+        local.tm_mday += day;
+        local.tm_hour = secondOfDay / 3600;
+        local.tm_min = secondOfDay / 60 % 60;
+        local.tm_sec = secondOfDay % 60;
+        local.tm_isdst = -1;
+        target = mktime(&local);
+        if(target > now.tv_sec){
+            break;
+        }
+    }
+    millis = (target - now.tv_sec) * 1000 - now.tv_nsec / 1000000;
+    return currentTick() + (millis + TICK_MILLIS-1) / TICK_MILLIS;
+}
+
+
+
+
+/*
+ Puts a schedule into the wheel slot for its due tick. Level 0 holds the next
+ WHEEL_SLOTS ticks and each level above covers WHEEL_SLOTS times as many; a schedule
+ moves down a level when its slot comes round. One due beyond the top level waits in its
+ farthest slot and is placed again from there.
+ */
+void insertSchedule(int index){
+    
+    schedule_t *schedule = schedules+index;
+    uint64_t delta;
+    int level = 0, slot;
+    
+    if(schedule->due < wheelTick){
+        schedule->due = wheelTick;
+    }
+    delta = schedule->due - wheelTick;
+    while(level < WHEEL_LEVELS-1 && delta >> (WHEEL_BITS * (level+1))){
+        ++level;
+    }
+    if(delta >> (WHEEL_BITS * WHEEL_LEVELS)){
+        slot = ((wheelTick >> (WHEEL_BITS * level)) + WHEEL_SLOTS-1) & (WHEEL_SLOTS-1);
+    }
+    else{
+        slot = (schedule->due >> (WHEEL_BITS * level)) & (WHEEL_SLOTS-1);
+    }
+    
+    schedule->slot = level*WHEEL_SLOTS + slot;
+    schedule->prev = -1;
+    schedule->next = wheel[schedule->slot];
+    if(schedule->next >= 0){
+        schedules[schedule->next].prev = index;
+    }
+    wheel[schedule->slot] = index;
+}
+
+
+
+
+/*
+ Takes a schedule out of its wheel slot.
+ */
+void unlinkSchedule(int index){
+    
+    schedule_t *schedule = schedules+index;
+    
+    if(schedule->prev >= 0){
+        schedules[schedule->prev].next = schedule->next;
+    }
+    else{
+        wheel[schedule->slot] = schedule->next;
+    }
+    if(schedule->next >= 0){
+        schedules[schedule->next].prev = schedule->prev;
+    }
+}
+
+
+
+
+/*
+ Moves the wheel on to the current tick, one tick at a time. At each tick the slots of
+ the levels whose period ends there are spread over the levels below, highest first, and
+ the schedules in the level 0 slot are run. Each tick costs the same however many
+ schedules there are, apart from the schedules that move or run.
+ */
+void advanceTimerWheel(void){
+    
+    uint64_t expirations, now = currentTick();
+    int level, slot, index, next;
+    
+    read(timerFd, &expirations, sizeof(expirations)); // the count is worked out from the clock
+    while(wheelTick < now){
+        ++wheelTick;
+        for(level=WHEEL_LEVELS-1; level >= 0; --level){
+            if(wheelTick & ((1ULL << (WHEEL_BITS * level)) - 1)){
+                continue;
+            }
+            slot = level*WHEEL_SLOTS + ((wheelTick >> (WHEEL_BITS * level)) & (WHEEL_SLOTS-1));
+            index = wheel[slot];
+            wheel[slot] = -1;
+            for(; index >= 0; index=next){
+                next = schedules[index].next;
+                if(level == 0 && schedules[index].due <= wheelTick){
+                    runSchedule(index, now);
+                }
+                else{
+                    insertSchedule(index);
+                }
+            }
+        }
+    }
+}
+
+
+
+
+/*
+ Starts a run of a due schedule, unless it is to be skipped, and puts the schedule back
+ for its next run. An every schedule's next run is one interval further along its
+ timeline; runs the shell was too busy to start by now are counted as missed.
+ */
+void runSchedule(int index, uint64_t now){
+    
+    schedule_t *schedule = schedules+index;
+    uint64_t missed;
+    
+    if((schedule->flags & SCHEDULE_SKIP_RUNNING) && schedule->running > 0){
+        ++schedule->skipped;
+    }
+    else if(startScheduleRun(index)){
+        ++schedule->runs;
+    }
+    else{
+        ++schedule->skipped;
+    }
+    
+    if(schedule->kind == SCHEDULE_EVERY){
+        schedule->nominal += schedule->interval;
+        if(schedule->nominal <= now){
+            missed = (now - schedule->nominal) / schedule->interval + 1;
+            schedule->nominal += missed * schedule->interval;
+            schedule->missed += missed;
+        }
+    }
+    else{
+        schedule->nominal = nextDailyTick(schedule->secondOfDay);
+    }
+    schedule->due = schedule->nominal + (schedule->jitter ? (uint64_t)random() % (schedule->jitter+1) : 0);
+    insertSchedule(index);
+}
+
+
+
+
+/*
+ Forks a copy of the shell to run a schedule's command line as a trace of its own.
+ Returns 0 if it could not be started.
+ */
+int startScheduleRun(int index){
+    
+    sigset_t childMask, oldMask;
+    FILE *line;
+    pid_t pid;
+    
+    sigemptyset(&childMask);
+    sigaddset(&childMask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &childMask, &oldMask);
+    
+    if(numScheduleRuns == MAX_SCHEDULE_RUNS){
+        sigprocmask(SIG_SETMASK, &oldMask, 0);
+        return 0;
+    }
+    pid = forkCommand();
+    if(pid < 0){
+        sigprocmask(SIG_SETMASK, &oldMask, 0);
+        fprintf(stderr, "Error! Could not fork process for schedule %d: %s.\n", index+1, strerror(errno));
+        return 0;
+    }
+    if(pid == 0){
+        sigprocmask(SIG_SETMASK, &oldMask, 0);
+        startNestedShell();
+        if(traceFd >= 0){
+            randomHexId(traceId, 16);
+            traceParentSpan[0] = 0;
+        }
+        line = fmemopen(schedules[index].command, strlen(schedules[index].command), "r");
+        _exit(line ? runLines(line, 0) : 1);
+    }
+    
+    scheduleRuns[numScheduleRuns].pid = pid;
+    scheduleRuns[numScheduleRuns].schedule = index;
+    ++numScheduleRuns;
+    ++schedules[index].running;
+    
+    sigprocmask(SIG_SETMASK, &oldMask, 0);
+    return 1;
+}
+
+
+
+
+/*
+ Waits until input has a line to read, running the schedules that fall due meanwhile.
+ An interactive shell also applies a SIGHUP reload while it is idle instead of after the
+ next line. Returns at once if the stream already holds buffered input, or if there are
+ no schedules and the shell is not interactive.
+ */
+void waitForInput(FILE *input, int interactive){
+    
+    struct pollfd ready[2];
+    
+    ready[0].fd = fileno(input);
+    ready[0].events = POLLIN;
+    ready[1].fd = timerFd;
+    ready[1].events = POLLIN;
+    while((numSchedules > 0 || interactive) && !INPUT_BUFFERED(input)){
+        if(poll(ready, 2, -1) < 0){
+            if(errno == EINTR){
+                applyPendingReload(); // poll is not restarted after SIGHUP
+                continue;
+            }
+            return;
+        }
+        if(ready[1].revents & POLLIN){
+            advanceTimerWheel();
+        }
+        if(ready[0].revents){
+            return;
+        }
+    }
+}
+
+
+
+
+/*
+ Runs the schedules for as long as there are any, once the shell has no more input.
+ Configuration reloads are applied as the signals arrive.
+ */
+void serveSchedules(void){
+    
+    struct pollfd ready;
+    
+    ready.fd = timerFd;
+    ready.events = POLLIN;
+    while(numSchedules > 0){
+        if(poll(&ready, 1, -1) > 0){
+            advanceTimerWheel();
+        }
+        reportFinishedJobs();
+        applyPendingReload();
+        fillWarmPool(); // follows a reloaded pool setting while the shell is idle
+    }
+}
+
+
+
+
+/*
+ Returns the array with the given name. If there is none, a free entry is claimed for it
+ when create is set, otherwise 0 is returned.
+ */
+array_t *findArray(const char *name, int create){
+    
+    array_t *free = 0;
+    int i;
+    
+    for(i=0; i < MAX_ARRAYS; ++i){
+        if(arrays[i].type == ARRAY_FREE){
+            if(!free){
+                free = arrays+i;
+            }
+        }
+        else if(strcmp(arrays[i].name, name) == 0){
+            return arrays+i;
+        }
+    }
+    
+    if(!create || !free || strlen(name) >= MAX_ARRAY_NAME_LEN){
+        return 0;
+    }
+    snprintf(free->name, MAX_ARRAY_NAME_LEN, "%s", name);
+    return free;
+}
+
+
+
+
+/*
+ Releases the storage of an array and marks its entry free.
+ */
+void clearArray(array_t *array){
+    
+    if(array->mapped){
+        munmap(array->text, array->textLength);
+    }
+    else{
+        free(array->text);
+    }
+    free(array->items);
+    memset(array, 0, sizeof(array_t));
+}
+
+
+
+
+/*
+ The array and assoc builtins. Replaces the array named by the first argument with the
+ remaining arguments:
+ 
+   array name [value...]
+   assoc name [key=value...]
+ 
+ All values are copied into one block so the elements of an array are contiguous.
+ Returns 0 on success or 1 on error.
+ */
+int defineArray(arg_t *argList, int type){
+    
+    array_t *array;
+    size_t length = 0, count = 0, capacity = 1, slot, i;
+    char *text, *value;
+    
+    if(!argList[0]){
+        fprintf(stderr, "Usage: array name [value...] or assoc name [key=value...]\n");
+        return 1;
+    }
+    array = findArray(argList[0], 1);
+    if(!array){
+        fprintf(stderr, "Error! Could not create array '%s'.\n", argList[0]);
+        return 1;
+    }
+    if(array->type != ARRAY_FREE){
+        clearArray(array);
+        snprintf(array->name, MAX_ARRAY_NAME_LEN, "%s", argList[0]);
+    }
+    
+    for(i=1; argList[i]; ++i){
+        length += strlen(argList[i])+1;
+        ++count;
+    }
+    while(capacity < 2*count){
+        capacity *= 2;
+    }
+    
+    array->type = type;
+    array->text = malloc(length ? length : 1);
+    array->textLength = length;
+    array->capacity = type == ARRAY_INDEXED ? count : capacity;
+    array->items = calloc(type == ARRAY_INDEXED ? count+1 : 2*capacity, sizeof(arg_t));
+    
+    for(text=array->text, i=1; argList[i]; ++i){
+        strcpy(text, argList[i]);
+        
+        if(type == ARRAY_INDEXED){
+            array->items[array->count++] = text;
+        }
+        else{
+            value = strchr(text, '=');
+            if(value){
+                *(value++) = 0;
+            }
+            
+            // linear probing; a repeated key replaces the earlier value
+            slot = hashLineField(text, strlen(text), 0) & (capacity-1);
+            while(array->items[2*slot] && strcmp(array->items[2*slot], text) != 0){
+                slot = (slot+1) & (capacity-1);
+            }
+            if(!array->items[2*slot]){
+                ++array->count;
+            }
+            array->items[2*slot] = text;
+            array->items[2*slot+1] = value ? value : text+strlen(text);
+        }
+        text += strlen(argList[i])+1;
+    }
+    return 0;
+}
+
+
+
+
+/*
+ The mapfile builtin. Loads the file on the command's input into the indexed array named
+ by its argument, one element per line:
+ 
+   mapfile name < file
+ 
+ A regular file is mapped privately in one piece and its newlines are overwritten with
+ string terminators, so the elements point straight into the mapping. Other inputs are
+ read into memory first. Returns 0 on success or 1 on error.
+ */
+int mapFileToArray(const command_t *command){
+    
+    arg_t *argList = COMMAND_ARGS(command);
+    array_t *array;
+    struct stat fileStat;
+    char *text = 0, *grown, *c, *end;
+    size_t length = 0, capacity = 0, count = 0;
+    ssize_t got;
+    long pageSize = sysconf(_SC_PAGESIZE);
+    int mapped = 0;
+    
+    if(!argList[1] || argList[2]){
+        fprintf(stderr, "Usage: mapfile name < file\n");
+        return 1;
+    }
+    
+    // the mapping must extend past the last byte to terminate a final unfinished line
+    if(fstat(command->fdIn, &fileStat) == 0 && S_ISREG(fileStat.st_mode) && fileStat.st_size > 0 &&
+       (fileStat.st_size % pageSize != 0)){
+        length = fileStat.st_size;
+        text = mmap(0, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, command->fdIn, 0);
+        if(text == MAP_FAILED){
+            text = 0;
+            length = 0;
+        }
+        else{
+            mapped = 1;
+        }
+    }
+    
+    if(!mapped){
+        while(1){
+            if(length+1 >= capacity){
+                capacity = capacity ? capacity*2 : COPY_BUFFER_LEN;
+                grown = realloc(text, capacity);
+                if(!grown){
+                    free(text);
+                    fprintf(stderr, "Error! Not enough memory to load array '%s'.\n", argList[1]);
+                    return 1;
+                }
+                text = grown;
+            }
+            got = read(command->fdIn, text+length, capacity-length-1);
+            if(got < 0 && errno == EINTR){
+                continue;
+            }
+            if(got <= 0){
+                break;
+            }
+            length += got;
+        }
+        if(!text){
+            text = malloc(1);
+        }
+        text[length] = 0;
+    }
+    
+    
+    array = findArray(argList[1], 1);
+    if(!array){
+        fprintf(stderr, "Error! Could not create array '%s'.\n", argList[1]);
+        if(mapped){
+            munmap(text, length);
+        }
+        else{
+            free(text);
+        }
+        return 1;
+    }
+    if(array->type != ARRAY_FREE){
+        clearArray(array);
+        snprintf(array->name, MAX_ARRAY_NAME_LEN, "%s", argList[1]);
+    }
+    
+    // count the lines first so the element vector is allocated once
+    end = text+length;
+    for(c=text; c < end && (c = memchr(c, '\n', end-c)); ++c){
+        ++count;
+    }
+    if(length > 0 && *(end-1) != '\n'){
+        ++count;
+    }
+    
+    array->type = ARRAY_INDEXED;
+    array->text = text;
+    array->textLength = length;
+    array->mapped = mapped;
+    array->items = malloc((count+1) * sizeof(arg_t));
+    array->capacity = count;
+    
+    for(c=text; c < end; ){
+        array->items[array->count++] = c;
+        c = memchr(c, '\n', end-c);
+        if(!c){
+            break;
+        }
+        *(c++) = 0;
+    }
+    return 0;
+}
+
+
+
+
+/*
+ Returns the element of an array selected by subscript: a position for indexed arrays or
+ a key for associative ones. Returns 0 if there is no such element.
+ */
+const char *lookupArrayElement(const array_t *array, const char *subscript){
+    
+    size_t slot;
+    char *end;
+    unsigned long index;
+    
+    if(array->type == ARRAY_INDEXED){
+        index = strtoul(subscript, &end, 10);
+        return (*subscript && !*end && index < array->count) ? array->items[index] : 0;
+    }
+    
+    slot = hashLineField(subscript, strlen(subscript), 0) & (array->capacity-1);
+    while(array->items[2*slot]){
+        if(strcmp(array->items[2*slot], subscript) == 0){
+            return array->items[2*slot+1];
+        }
+        slot = (slot+1) & (array->capacity-1);
+    }
+    return 0;
+}
+
+
+
+
+/*
+ Expands array references in an argument list. An argument written exactly as
+ ${name[@]} becomes one argument per element (the values of an associative array), and
+ ${name[subscript]} becomes a single element, or an empty argument if there is none. The
+ expanded list points at the array storage rather than copying elements. Returns the
+ original list when it has no references. Only called in forked children, which may
+ allocate.
+ */
+arg_t *expandArrays(arg_t *argList){
+    
+    arg_t *expanded = 0;
+    const array_t *array;
+    const char *element;
+    char name[MAX_ARRAY_NAME_LEN];
+    char *open;
+    size_t count, length, i, j;
+    int references = 0, pass;
+    
+    // the first pass sizes the result, the second fills it
+    for(pass=0; pass < 2; ++pass){
+        count = 0;
+        for(i=0; argList[i]; ++i){
+            length = strlen(argList[i]);
+            open = strchr(argList[i], '[');
+            
+            if(!(length > 5 && open && strncmp(argList[i], "${", 2) == 0 &&
+                 strcmp(argList[i]+length-2, "]}") == 0 && (size_t)(open-argList[i]-2) < MAX_ARRAY_NAME_LEN)){
+                if(pass){
+                    expanded[count] = argList[i];
+                }
+                ++count;
+                continue;
+            }
+            
+            ++references;
+            snprintf(name, MAX_ARRAY_NAME_LEN, "%.*s", (int)(open-argList[i]-2), argList[i]+2);
+            array = findArray(name, 0);
+            
+            if(strcmp(open, "[@]}") == 0){
+                for(j=0; array && j < array->capacity; ++j){
+                    element = array->type == ARRAY_INDEXED ? array->items[j] :
+                              (array->items[2*j] ? array->items[2*j+1] : 0);
+                    if(element){
+                        if(pass){
+                            expanded[count] = (arg_t)element;
+                        }
+                        ++count;
+                    }
+                }
+            }
+            else{
+                if(pass){
+                    expanded[count] = (arg_t)resolveElementReference(argList[i]);
+                }
+                ++count;
+            }
+        }
+        
+        if(!references){
+            return argList;
+        }
+        if(!pass){
+            expanded = malloc((count+1) * sizeof(arg_t));
+        }
+    }
+    
+    expanded[count] = 0;
+    return expanded;
+}
+
+
+
+
+/*
+ Returns the element an argument written exactly as ${name[subscript]} refers to, an
+ empty string if there is no such element, or the argument itself if it is not an
+ element reference.
+ */
+const char *resolveElementReference(const char *arg){
+    
+    char name[MAX_ARRAY_NAME_LEN];
+    char subscript[MAX_SUBSCRIPT_LEN];
+    const char *open = strchr(arg, '[');
+    const char *element = 0;
+    const array_t *array;
+    size_t length = strlen(arg);
+    
+    if(!(length > 5 && open && strncmp(arg, "${", 2) == 0 && strcmp(arg+length-2, "]}") == 0)){
+        return arg;
+    }
+    
+    if((size_t)(open-arg-2) < MAX_ARRAY_NAME_LEN && length-(open-arg)-3 < MAX_SUBSCRIPT_LEN){
+        snprintf(name, MAX_ARRAY_NAME_LEN, "%.*s", (int)(open-arg-2), arg+2);
+        snprintf(subscript, MAX_SUBSCRIPT_LEN, "%.*s", (int)(length-(open-arg)-3), open+1);
+        array = findArray(name, 0);
+        element = array ? lookupArrayElement(array, subscript) : 0;
+    }
+    return element ? element : "";
+}
+
+
+
+
+/*
+ The [[ builtin. Tests a word against a pattern:
+ 
+   [[ word =~ regex ]]      extended regular expression search
+   [[ word == glob ]]       whole-word glob match; = is the same and != negates it
+ 
+ A glob may list alternatives separated by |, which are compiled together into a single
+ regex so matching several arms costs one pass over the word. Compiled patterns are
+ cached, so a test repeated in a loop does not recompile its pattern. Returns 0 on a
+ match, 1 on no match and 2 on a usage error.
+ */
+int executeTest(arg_t *argList){
+    
+    const regex_t *regex;
+    const char *word, *op;
+    int isGlob, matched;
+    
+    if(!(argList[1] && argList[2] && argList[3] && argList[4] && strcmp(argList[4], "]]") == 0 && !argList[5])){
+        fprintf(stderr, "Usage: [[ word =~ regex ]] or [[ word == glob ]]\n");
+        return 2;
+    }
+    
+    word = resolveElementReference(argList[1]);
+    op = argList[2];
+    isGlob = strcmp(op, "==") == 0 || strcmp(op, "=") == 0 || strcmp(op, "!=") == 0;
+    if(!isGlob && strcmp(op, "=~") != 0){
+        fprintf(stderr, "Error! Unknown test operator '%s'.\n", op);
+        return 2;
+    }
+    
+    regex = compilePattern(resolveElementReference(argList[3]), isGlob);
+    if(!regex){
+        fprintf(stderr, "Error! Invalid pattern '%s'.\n", argList[3]);
+        return 2;
+    }
+    
+    // glibc's matcher allocates its own scratch state for each search
+    ALLOW_ALLOCATIONS(1);
+    matched = regexec(regex, word, 0, 0, 0) == 0;
+    ALLOW_ALLOCATIONS(0);
+    
+    return strcmp(op, "!=") == 0 ? matched : !matched;
+}
+
+
+
+
+/*
+ Returns the compiled form of a pattern from the cache, compiling it on a miss. The
+ cache is direct mapped on the hash of the pattern text, so a lookup is one hash and one
+ comparison, and a colliding pattern replaces the older one. Globs are translated to an
+ anchored extended regex first: * and ? become .* and ., bracket expressions are kept
+ (with a leading ! turned into ^), | separates alternatives and other regex characters
+ are escaped, including a [ that is never closed, which is literal as in bash. Returns 0
+ if the pattern does not compile.
+ */
+const regex_t *compilePattern(const char *source, int isGlob){
+    
+    pattern_t *entry;
+    char *translated, *out;
+    const char *c, *bracketStart, *bracketEnd;
+    unsigned long hash;
+    int failed;
+    
+    hash = hashLineField(source, strlen(source), 0) ^ isGlob;
+    entry = patternCache + (hash & (PATTERN_CACHE_SIZE-1));
+    if(entry->source && entry->isGlob == isGlob && strcmp(entry->source, source) == 0){
+        return &entry->regex;
+    }
+    
+    ALLOW_ALLOCATIONS(1);
+    if(entry->source){
+        regfree(&entry->regex);
+        free(entry->source);
+        entry->source = 0;
+    }
+    
+    translated = 0;
+    if(isGlob){
+        translated = malloc(2*strlen(source)+5);
+        if(!translated){
+            fprintf(stderr, "Error! Not enough memory to compile pattern '%s'.\n", source);
+            ALLOW_ALLOCATIONS(0);
+            return 0;
+        }
+        out = translated;
+        *(out++) = '^';
+        *(out++) = '(';
+        for(c=source; *c; ++c){
+            if(*c == '*'){
+                *(out++) = '.';
+                *(out++) = '*';
+            }
+            else if(*c == '?'){
+                *(out++) = '.';
+            }
+            else if(*c == '|'){
+                *(out++) = '|';
+            }
+            else if(*c == '[' && *(bracketStart = c+1+(c[1] == '!')) && (bracketEnd = strchr(bracketStart+1, ']'))){
+                // a ] straight after the opening bracket is part of the set
+                *(out++) = '[';
+                if(*(++c) == '!'){
+                    *(out++) = '^';
+                    ++c;
+                }
+                memcpy(out, c, bracketEnd-c);
+                out += bracketEnd-c;
+                *(out++) = ']';
+                c = bracketEnd;
+            }
+            else{
+                if(strchr(".^$+(){}[\\", *c)){
+                    *(out++) = '\\';
+                }
+                *(out++) = *c;
+            }
+        }
+        *(out++) = ')';
+        *(out++) = '$';
+        *out = 0;
+    }
+    
+    failed = regcomp(&entry->regex, translated ? translated : source, REG_EXTENDED | REG_NOSUB);
+    free(translated);
+    if(!failed && !(entry->source = strdup(source))){
+        regfree(&entry->regex);
+        failed = 1;
+    }
+    if(!failed){
+        entry->isGlob = isGlob;
+    }
+    ALLOW_ALLOCATIONS(0);
+    
+    return failed ? 0 : &entry->regex;
+}
+
+
+
+
+/*
+ Turns tracing on when $MICROSHELL_TRACE names an output: a file that batches of spans are
+ appended to as OTLP-JSON, one batch per line, or unix:path for a UNIX stream socket. The
+ spans join the trace in an incoming W3C $TRACEPARENT under its span, or start a new trace.
+ */
+void initTracing(void){
+    
+    const char *output = getenv("MICROSHELL_TRACE");
+    const char *parent = getenv("TRACEPARENT");
+    struct sockaddr_un address;
+    
+    
+    if(!output || !*output){
+        return;
+    }
+    
+    if(strncmp(output, "unix:", 5) == 0){
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        snprintf(address.sun_path, sizeof(address.sun_path), "%s", output+5);
+        traceFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(traceFd >= 0 && connect(traceFd, (struct sockaddr *)&address, sizeof(address)) < 0){
+            close(traceFd);
+            traceFd = -1;
+        }
+        traceIsSocket = 1;
+    }
+    else{
+        traceFd = open(output, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    }
+    if(traceFd < 0){
+        fprintf(stderr, "Error! Could not open trace output '%s'.\n", output);
+        return;
+    }
+    spanOwner = getpid();
+    
+    // every span carries the delays of the children waited for while it was open
+    if(enableDelayAccounting()){
+        ++collectingDelays;
+    }
+    
+    // version-trace id-parent id-flags, where neither id may be all zeros
+    if(parent && strlen(parent) >= 55 && strncmp(parent, "ff", 2) != 0 &&
+       strspn(parent, "0123456789abcdef") == 2 && parent[2] == '-' &&
+       strspn(parent+3, "0123456789abcdef") == 32 && strspn(parent+3, "0") != 32 && parent[35] == '-' &&
+       strspn(parent+36, "0123456789abcdef") == 16 && strspn(parent+36, "0") != 16 && parent[52] == '-' &&
+       strspn(parent+53, "0123456789abcdef") == 2 && (parent[55] == 0 || parent[55] == '-')){
+        memcpy(traceId, parent+3, 32);
+        memcpy(traceParentSpan, parent+36, 16);
+        memcpy(traceFlags, parent+53, 2);
+    }
+    else{
+        randomHexId(traceId, 16);
+        traceParentSpan[0] = 0;
+    }
+}
+
+
+
+
+/*
+ Starts a span named prefix followed by name as a child of parentId, or of nothing if it
+ is empty, and makes it the parent advertised to commands spawned from now on. Does
+ nothing if tracing is off.
+ */
+void beginSpan(span_t *span, const char *parentId, const char *prefix, const char *name){
+    
+    struct timespec now;
+    
+    
+    if(traceFd < 0){
+        return;
+    }
+    
+    randomHexId(span->spanId, 8);
+    snprintf(span->parentId, sizeof(span->parentId), "%s", parentId);
+    snprintf(span->name, MAX_SPAN_NAME_LEN, "%s%s", prefix, name);
+    clock_gettime(CLOCK_REALTIME, &now);
+    span->startNanos = now.tv_sec * 1000000000ULL + now.tv_nsec;
+    if(childDelays){
+        span->delays = *childDelays;
+    }
+    span->cpuMicros = childCpuMicros;
+    span->maxRssKb = childMaxRssKb; // the peak before the span, restored when it ends
+    childMaxRssKb = 0;
+    span->submittedNanos = 0;
+    
+    snprintf(childTraceParent, sizeof(childTraceParent), "TRACEPARENT=00-%s-%s-%s", traceId, span->spanId, traceFlags);
+}
+
+
+
+
+/*
+ Finishes a span with the exit status of what it covered and adds it to the batch,
+ exporting the batch once it is full. Does nothing if tracing is off.
+ */
+void endSpan(span_t *span, int exitStatus){
+    
+    struct timespec now;
+    long outerMaxRssKb;
+    int i;
+    
+    
+    if(traceFd < 0){
+        return;
+    }
+    
+    clock_gettime(CLOCK_REALTIME, &now);
+    span->endNanos = now.tv_sec * 1000000000ULL + now.tv_nsec;
+    span->exitStatus = exitStatus;
+    if(childDelays){
+        for(i=0; i < NUM_DELAYS; ++i){
+            span->delays.nanos[i] = childDelays->nanos[i] - span->delays.nanos[i];
+        }
+        span->delays.unknown = childDelays->unknown;
+    }
+    span->cpuMicros = childCpuMicros - span->cpuMicros;
+    outerMaxRssKb = span->maxRssKb;
+    span->maxRssKb = childMaxRssKb;
+    if(outerMaxRssKb > childMaxRssKb){
+        childMaxRssKb = outerMaxRssKb;
+    }
+    
+    spanBatch[numSpans++] = *span;
+    if(numSpans == SPAN_BATCH_LEN){
+        flushSpans();
+    }
+}
+
+
+
+
+/*
+ Writes the batch of finished spans to the trace output as one OTLP-JSON export request
+ on a single line. Only the process that recorded the spans exports them, so a forked
+ child never repeats its parent's batch. If a socket collector has gone away tracing is
+ turned off.
+ */
+void flushSpans(void){
+    
+    static const char *delayKeys[NUM_DELAYS] = {"run_queue", "block_io", "swap_in", "reclaim"};
+    static char buffer[TRACE_BUFFER_LEN];
+    char name[MAX_SPAN_NAME_LEN*6];
+    char *out;
+    const char *c;
+    size_t length, written;
+    ssize_t sent;
+    int i, j;
+    
+    
+    if(traceFd < 0 || !numSpans || getpid() != spanOwner){
+        return;
+    }
+    
+    length = snprintf(buffer, TRACE_BUFFER_LEN,
+                      "{\"resourceSpans\":[{\"resource\":{\"attributes\":[{\"key\":\"service.name\","
+                      "\"value\":{\"stringValue\":\"microshell\"}}]},"
+                      "\"scopeSpans\":[{\"scope\":{\"name\":\"microshell\"},\"spans\":[");
+    
+    for(i=0; i < numSpans; ++i){
+        out = name;
+        for(c=spanBatch[i].name; *c; ++c){
+            if(*c == '"' || *c == '\\'){
+                *(out++) = '\\';
+                *(out++) = *c;
+            }
+            else if((unsigned char)*c < 0x20){
+                out += sprintf(out, "\\u%04x", *c);
+            }
+            else{
+                *(out++) = *c;
+            }
+        }
+        *out = 0;
+        
+        length += snprintf(buffer+length, TRACE_BUFFER_LEN-length,
+                           "%s{\"traceId\":\"%s\",\"spanId\":\"%s\",\"parentSpanId\":\"%s\",\"name\":\"%s\","
+                           "\"kind\":1,\"startTimeUnixNano\":\"%llu\",\"endTimeUnixNano\":\"%llu\","
+                           "\"attributes\":[{\"key\":\"process.exit.code\",\"value\":{\"intValue\":\"%d\"}}",
+                           i ? "," : "", traceId, spanBatch[i].spanId, spanBatch[i].parentId, name,
+                           (unsigned long long)spanBatch[i].startNanos, (unsigned long long)spanBatch[i].endNanos,
+                           spanBatch[i].exitStatus);
+        for(j=0; childDelays && j < NUM_DELAYS; ++j){
+            if(!(spanBatch[i].delays.unknown & (1 << j))){
+                length += snprintf(buffer+length, TRACE_BUFFER_LEN-length,
+                                   ",{\"key\":\"microshell.delay.%s_ns\",\"value\":{\"intValue\":\"%llu\"}}",
+                                   delayKeys[j], (unsigned long long)spanBatch[i].delays.nanos[j]);
+            }
+        }
+        length += snprintf(buffer+length, TRACE_BUFFER_LEN-length,
+                           ",{\"key\":\"microshell.cpu_us\",\"value\":{\"intValue\":\"%ld\"}}"
+                           ",{\"key\":\"microshell.max_rss_kb\",\"value\":{\"intValue\":\"%ld\"}}",
+                           spanBatch[i].cpuMicros, spanBatch[i].maxRssKb);
+        if(spanBatch[i].submittedNanos){
+            length += snprintf(buffer+length, TRACE_BUFFER_LEN-length,
+                               ",{\"key\":\"microshell.job.submitted_unix_nano\",\"value\":{\"intValue\":\"%llu\"}}",
+                               (unsigned long long)spanBatch[i].submittedNanos);
+        }
+        length += snprintf(buffer+length, TRACE_BUFFER_LEN-length, "],\"status\":{\"code\":%d}}",
+                           spanBatch[i].exitStatus ? 2 : 1);
+    }
+    length += snprintf(buffer+length, TRACE_BUFFER_LEN-length, "]}]}]}\n");
+    numSpans = 0;
+    
+    if(!traceIsSocket){
+        writeAll(traceFd, buffer, length);
+        return;
+    }
+    
+    // a collector that disconnects must not raise SIGPIPE in the shell
+    for(written=0; written < length; written += sent){
+        sent = send(traceFd, buffer+written, length-written, MSG_NOSIGNAL);
+        if(sent < 0 && errno == EINTR){
+            sent = 0;
+        }
+        else if(sent <= 0){
+            fprintf(stderr, "Error! Lost the trace collector, tracing is off.\n");
+            close(traceFd);
+            traceFd = -1;
+            return;
+        }
+    }
+}
+
+
+
+
+/*
+ Fills id with bytes random bytes written as lowercase hex and a terminating null.
+ */
+void randomHexId(char *id, int bytes){
+    
+    static uint64_t counter = 0;
+    unsigned char random[16];
+    struct timespec now;
+    uint64_t seed;
+    int i;
+    
+    
+    // requests of up to 256 bytes are never short, so this only fails without entropy
+    if(getrandom(random, bytes, GRND_NONBLOCK) != bytes){
+        clock_gettime(CLOCK_REALTIME, &now);
+        seed = (now.tv_sec * 1000000000ULL + now.tv_nsec) ^ ((uint64_t)getpid() << 32) ^ ++counter;
+        for(i=0; i < bytes; ++i){
+            seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+            random[i] = seed >> 56;
+        }
+    }
+    for(i=0; i < bytes; ++i){
+        sprintf(id+2*i, "%02x", random[i]);
+    }
+}
+
+
+
+
+/*
+ The cache builtin. Usage:
+ 
+   cache command [args...]
+ 
+ Runs the command and, if it succeeds, keeps its output keyed by the command line, the
+ working directory and a hash of the environment. The entry's dependencies are discovered rather than declared: every
+ file the command or its descendants open for reading or try to execute is traced with
+ seccomp user notification and recorded with its fingerprint (inode, size and
+ modification time), including files that did not exist. A later run whose dependencies
+ all still match replays the output without running the command. Input redirected from a
+ file is part of the key, input from a pipeline makes the result uncacheable. Entries live in
+ $MICROSHELL_CACHE, or ~/.cache/microshell. Returns the exit status of the command.
+ */
+int executeCachedCommand(const command_t *command){
+    
+    arg_t *argList = COMMAND_ARGS(command)+1;
+    char cacheDir[MAX_PATH_LEN], entryPath[MAX_PATH_LEN+32], cwd[MAX_PATH_LEN], input[MAX_PATH_LEN], link[64];
+    char environment[17], *key, *inputs = 0, *c, **variable;
+    size_t keyLength, inputsLength = 0;
+    unsigned long hash = 14695981039346656037UL, environmentHash = 14695981039346656037UL;
+    int i, outFile, exitStatus, traced = 0, cacheable = 1;
+    struct stat inputStat;
+    ssize_t length;
+    
+    
+    if(!argList[0]){
+        fprintf(stderr, "Error! Usage: cache command [args...]\n");
+        return 1;
+    }
+    
+    if(getenv("MICROSHELL_CACHE")){
+        snprintf(cacheDir, MAX_PATH_LEN, "%s", getenv("MICROSHELL_CACHE"));
+    }
+    else{
+        snprintf(cacheDir, MAX_PATH_LEN, "%s/.cache/microshell", getenv("HOME") ? getenv("HOME") : "");
+    }
+    for(c=cacheDir+1; ; ++c){
+        if(*c == '/' || *c == 0){
+            i = *c;
+            *c = 0;
+            mkdir(cacheDir, 0700);
+            *c = i;
+        }
+        if(!*c){
+            break;
+        }
+    }
+    
+    // a redirected input is named in the key, input from a pipeline cannot be fingerprinted
+    input[0] = 0;
+    if(command->fdIn != fileno(stdin)){
+        snprintf(link, sizeof(link), "/proc/self/fd/%d", command->fdIn);
+        length = readlink(link, input, MAX_PATH_LEN-1);
+        input[length > 0 ? length : 0] = 0;
+    }
+    else if(getpid() != shellPid && fstat(command->fdIn, &inputStat) == 0 &&
+            (S_ISFIFO(inputStat.st_mode) || S_ISSOCK(inputStat.st_mode))){
+        cacheable = 0;
+    }
+    
+    // the variables a nested shell's children set for every command would defeat the cache
+    for(variable=environ; variable && *variable; ++variable){
+        if(strncmp(*variable, "MS_OVERHEAD_US=", 15) == 0 || strncmp(*variable, "TRACEPARENT=", 12) == 0){
+            continue;
+        }
+        for(c=*variable; ; ++c){
+            environmentHash = (environmentHash ^ (unsigned char)*c) * 1099511628211UL;
+            if(!*c){
+                break;
+            }
+        }
+    }
+    snprintf(environment, sizeof(environment), "%016lx", environmentHash);
+    
+    // the key is the working directory, input, environment hash and arguments, each null-terminated
+    if(!getcwd(cwd, MAX_PATH_LEN)){
+        cwd[0] = 0;
+    }
+    keyLength = strlen(cwd)+1 + strlen(input)+1 + sizeof(environment);
+    for(i=0; argList[i]; ++i){
+        keyLength += strlen(argList[i])+1;
+    }
+    key = malloc(keyLength);
+    keyLength = strlen(cwd)+1;
+    memcpy(key, cwd, keyLength);
+    memcpy(key+keyLength, input, strlen(input)+1);
+    keyLength += strlen(input)+1;
+    memcpy(key+keyLength, environment, sizeof(environment));
+    keyLength += sizeof(environment);
+    for(i=0; argList[i]; ++i){
+        memcpy(key+keyLength, argList[i], strlen(argList[i])+1);
+        keyLength += strlen(argList[i])+1;
+    }
+    for(i=0; i < (int)keyLength; ++i){
+        hash = (hash ^ (unsigned char)key[i]) * 1099511628211UL;
+    }
+    snprintf(entryPath, sizeof(entryPath), "%s/%016lx", cacheDir, hash);
+    
+    if(cacheable && replayCacheEntry(entryPath, key, keyLength, command->fdOut)){
+        free(key);
+        return 0;
+    }
+    
+    
+    outFile = openScratchFile();
+    if(outFile < 0){
+        fprintf(stderr, "Error! Could not create output file for cache.\n");
+        free(key);
+        return 1;
+    }
+    
+    exitStatus = runTracedCommand(argList, command->fdIn, outFile, &inputs, &inputsLength, &traced);
+    lseek(outFile, 0, SEEK_SET);
+    copyFileContents(outFile, command->fdOut);
+    
+    if(exitStatus == 0 && traced && cacheable){
+        storeCacheEntry(entryPath, key, keyLength, inputs, inputsLength, outFile);
+    }
+    else if(!traced){
+        fprintf(stderr, "Error! Could not trace the inputs of '%s', the result is not cached.\n", argList[0]);
+    }
+    
+    close(outFile);
+    free(inputs);
+    free(key);
+    return exitStatus;
+}
+
+
+
+
+/*
+ Writes the output kept in a cache entry to fdOut if the entry belongs to key and every
+ one of its dependencies still has the recorded fingerprint. An entry is a header line,
+ the key, a line per dependency, an empty line and then the output. Returns 1 on a hit.
+ */
+int replayCacheEntry(const char *entryPath, const char *key, size_t keyLength, int fdOut){
+    
+    char line[MAX_PATH_LEN+128];
+    const char *data, *next, *end;
+    struct stat fileStat, depStat;
+    unsigned long inode;
+    long long size, seconds;
+    long nanos;
+    size_t entryKeyLength;
+    int fd, offset, hit = 0;
+    
+    
+    fd = open(entryPath, O_RDONLY | O_CLOEXEC);
+    if(fd < 0){
+        return 0;
+    }
+    if(fstat(fd, &fileStat) < 0 || fileStat.st_size == 0 ||
+       (data = mmap(0, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED){
+        close(fd);
+        return 0;
+    }
+    close(fd);
+    end = data+fileStat.st_size;
+    
+    next = memchr(data, '\n', end-data);
+    if(!next || next-data >= (long)sizeof(line)){
+        goto done;
+    }
+    memcpy(line, data, next-data);
+    line[next-data] = 0;
+    if(sscanf(line, CACHE_FORMAT " %zu", &entryKeyLength) != 1 || entryKeyLength != keyLength ||
+       end-(next+1) < (long)keyLength+1 || memcmp(next+1, key, keyLength) != 0 || next[1+keyLength] != '\n'){
+        goto done;
+    }
+    
+    for(data=next+keyLength+2; data < end; data=next+1){
+        next = memchr(data, '\n', end-data);
+        if(!next || next-data >= (long)sizeof(line)){
+            goto done;
+        }
+        if(next == data){
+            hit = 1; // every dependency matched
+            break;
+        }
+        memcpy(line, data, next-data);
+        line[next-data] = 0;
+        
+        if(line[0] == '-'){
+            if(stat(line+2, &depStat) == 0){
+                goto done; // a file that was missing has appeared
+            }
+        }
+        else if(sscanf(line, "%lu %lld %lld %ld %n", &inode, &size, &seconds, &nanos, &offset) != 4 ||
+                stat(line+offset, &depStat) < 0 || depStat.st_ino != inode || depStat.st_size != size ||
+                depStat.st_mtim.tv_sec != seconds || depStat.st_mtim.tv_nsec != nanos){
+            goto done;
+        }
+    }
+    
+    if(hit){
+        writeAll(fdOut, next+1, end-(next+1));
+    }
+    
+done:
+    munmap((void *)(end-fileStat.st_size), fileStat.st_size);
+    return hit;
+}
+
+
+
+
+/*
+ Compares two strings through pointers to them, for sorting traced inputs.
+ */
+int comparePaths(const void *a, const void *b){
+    
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+
+
+
+/*
+ Replaces the cache entry at entryPath with one holding the key, a fingerprint of each
+ distinct traced input and the output in outFile. The entry is written under a temporary
+ name and renamed into place, so readers see either the old entry or the new one.
+ Returns 0 on success.
+ */
+int storeCacheEntry(const char *entryPath, const char *key, size_t keyLength, char *inputs, size_t inputsLength, int outFile){
+    
+    char tempPath[MAX_PATH_LEN+64];
+    char **paths;
+    size_t numPaths = 0, offset, i;
+    struct stat depStat;
+    FILE *entry;
+    int fd, failed = 0;
+    
+    
+    for(offset=0; offset < inputsLength; offset += strlen(inputs+offset)+1){
+        ++numPaths;
+    }
+    paths = malloc((numPaths+1) * sizeof(char *));
+    numPaths = 0;
+    for(offset=0; offset < inputsLength; offset += strlen(inputs+offset)+1){
+        paths[numPaths++] = inputs+offset;
+    }
+    qsort(paths, numPaths, sizeof(char *), comparePaths);
+    
+    snprintf(tempPath, sizeof(tempPath), "%s.%d", entryPath, (int)getpid());
+    fd = open(tempPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if(fd < 0 || !(entry = fdopen(fd, "w"))){
+        if(fd >= 0){
+            close(fd);
+        }
+        free(paths);
+        return 1;
+    }
+    
+    fprintf(entry, CACHE_FORMAT " %zu\n", keyLength);
+    fwrite(key, 1, keyLength, entry);
+    fputc('\n', entry);
+    for(i=0; i < numPaths; ++i){
+        if(i > 0 && strcmp(paths[i], paths[i-1]) == 0){
+            continue;
+        }
+        if(strchr(paths[i], '\n')){
+            failed = 1; // the entry format cannot hold this name
+        }
+        else if(stat(paths[i], &depStat) < 0){
+            fprintf(entry, "- %s\n", paths[i]);
+        }
+        else{
+            fprintf(entry, "%lu %lld %lld %ld %s\n", (unsigned long)depStat.st_ino, (long long)depStat.st_size,
+                    (long long)depStat.st_mtim.tv_sec, depStat.st_mtim.tv_nsec, paths[i]);
+        }
+    }
+    fputc('\n', entry);
+    fflush(entry);
+    
+    lseek(outFile, 0, SEEK_SET);
+    if(ferror(entry) || copyFileContents(outFile, fd) < 0){
+        failed = 1;
+    }
+    if(fclose(entry) != 0 || failed || rename(tempPath, entryPath) < 0){
+        unlink(tempPath);
+        failed = 1;
+    }
+    
+    free(paths);
+    return failed;
+}
+
+
+
+
+/*
+ Runs a command with its input on fdIn and output on fdOut, and collects every path the
+ command and its descendants open for reading or execute into *inputs, as a sequence of
+ null-terminated absolute paths. The child installs a seccomp filter that hands those
+ calls to the shell, which reads the path out of the child's memory and lets the call
+ continue unchanged. *traced is set to 0 if the kernel does not support this, in which
+ case the command still runs, or if some path could not be read, made absolute or
+ stored, so the inputs are incomplete. Returns the exit status of the command.
+ */
+int runTracedCommand(arg_t *argList, int fdIn, int fdOut, char **inputs, size_t *inputsLength, int *traced){
+    
+    static char request[MAX_SECCOMP_NOTIF_LEN], response[MAX_SECCOMP_NOTIF_LEN];
+    struct seccomp_notif *notif = (struct seccomp_notif *)request;
+    struct seccomp_notif_resp *reply = (struct seccomp_notif_resp *)response;
+    struct seccomp_notif_sizes sizes;
+    union{
+        struct cmsghdr header;
+        char space[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr message;
+    struct iovec vector;
+    struct pollfd poller;
+    char marker, path[MAX_PATH_LEN], base[MAX_PATH_LEN], link[64];
+    size_t inputsCapacity = 0;
+    unsigned long address;
+    uint64_t howFlags;
+    ssize_t length;
+    int sockets[2], notifyFd = -1, memFd, dirFd, flags, exitStatus, complete = 1;
+    pid_t pid;
+    
+    
+    *traced = 0;
+    if(syscall(SYS_seccomp, SECCOMP_GET_NOTIF_SIZES, 0, &sizes) < 0 ||
+       sizes.seccomp_notif > MAX_SECCOMP_NOTIF_LEN || sizes.seccomp_notif_resp > MAX_SECCOMP_NOTIF_LEN ||
+       socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) < 0){
+        sockets[0] = sockets[1] = -1;
+    }
+    
+    pid = forkCommand();
+    if(pid < 0){
+        fprintf(stderr, "Error! Could not fork process for command '%s': %s.\n", argList[0], strerror(errno));
+        if(sockets[0] >= 0){
+            close(sockets[0]);
+            close(sockets[1]);
+        }
+        return 1;
+    }
+    else if(pid == 0){
+        dup2(fdIn, fileno(stdin));
+        dup2(fdOut, fileno(stdout));
+        if(sockets[0] >= 0){
+            close(sockets[0]);
+            inputsTraced = installInputTracer(sockets[1]) == 0;
+            close(sockets[1]);
+        }
+        execCommand(argList);
+    }
+    
+    
+    // the child sends its listener, or just hangs up if it could not install the filter
+    if(sockets[0] >= 0){
+        close(sockets[1]);
+        memset(&message, 0, sizeof(message));
+        vector.iov_base = &marker;
+        vector.iov_len = 1;
+        message.msg_iov = &vector;
+        message.msg_iovlen = 1;
+        message.msg_control = control.space;
+        message.msg_controllen = sizeof(control.space);
+        while((length = recvmsg(sockets[0], &message, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR);
+        if(length == 1 && CMSG_FIRSTHDR(&message) && CMSG_FIRSTHDR(&message)->cmsg_type == SCM_RIGHTS){
+            memcpy(&notifyFd, CMSG_DATA(CMSG_FIRSTHDR(&message)), sizeof(int));
+        }
+        close(sockets[0]);
+    }
+    
+    // the input of a redirect from a regular file was opened by the shell, not the command
+    if(notifyFd >= 0 && fdIn != fileno(stdin)){
+        snprintf(link, sizeof(link), "/proc/self/fd/%d", fdIn);
+        length = readlink(link, path, MAX_PATH_LEN-1);
+        if(length > 0 && path[0] == '/'){
+            path[length] = 0;
+            if(!addTracedInput(inputs, inputsLength, &inputsCapacity, "", path)){
+                complete = 0;
+            }
+        }
+    }
+    
+    // serve notifications until every process using the filter has exited
+    while(notifyFd >= 0){
+        poller.fd = notifyFd;
+        poller.events = POLLIN;
+        if(poll(&poller, 1, -1) < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            break;
+        }
+        if(!(poller.revents & POLLIN)){
+            break;
+        }
+        
+        memset(request, 0, sizes.seccomp_notif);
+        if(ioctl(notifyFd, SECCOMP_IOCTL_NOTIF_RECV, notif) < 0){
+            if(errno == EINTR || errno == ENOENT){
+                continue;
+            }
+            break;
+        }
+        
+        address = notif->data.args[0];
+        dirFd = AT_FDCWD;
+        flags = O_RDONLY;
+        if(notif->data.nr == SYS_openat
+#ifdef SYS_openat2
+           || notif->data.nr == SYS_openat2
+#endif
+           ){
+            dirFd = (int)notif->data.args[0];
+            address = notif->data.args[1];
+            flags = (int)notif->data.args[2]; // for openat2, replaced by the flags of its open_how
+        }
+#ifdef SYS_open
+        else if(notif->data.nr == SYS_open){
+            flags = (int)notif->data.args[1];
+        }
+#endif
+        
+        // the path is read while the call is held, then the call proceeds untouched
+        length = -1;
+        snprintf(link, sizeof(link), "/proc/%d/mem", (int)notif->pid);
+        memFd = open(link, O_RDONLY | O_CLOEXEC);
+        if(memFd >= 0){
+            length = pread(memFd, path, MAX_PATH_LEN-1, address);
+#ifdef SYS_openat2
+            // struct open_how starts with its 64-bit flags
+            if(notif->data.nr == SYS_openat2){
+                if(pread(memFd, &howFlags, sizeof(howFlags), notif->data.args[2]) == sizeof(howFlags)){
+                    flags = (int)howFlags;
+                }
+                else{
+                    flags = O_RDONLY;
+                    length = -1;
+                }
+            }
+#endif
+            close(memFd);
+        }
+        base[0] = 0;
+        if(length > 0){
+            path[length] = 0;
+            if(path[0] != '/'){
+                if(dirFd == AT_FDCWD){
+                    snprintf(link, sizeof(link), "/proc/%d/cwd", (int)notif->pid);
+                }
+                else{
+                    snprintf(link, sizeof(link), "/proc/%d/fd/%d", (int)notif->pid, dirFd);
+                }
+                length = readlink(link, base, MAX_PATH_LEN-1);
+                base[length > 0 ? length : 0] = 0;
+            }
+        }
+        
+        // an input that cannot be named cannot be fingerprinted, so nothing may be stored
+        if((flags & O_ACCMODE) != O_WRONLY && (length <= 0 || (path[0] != '/' && base[0] != '/'))){
+            complete = 0;
+        }
+        
+        memset(response, 0, sizes.seccomp_notif_resp);
+        reply->id = notif->id;
+        reply->flags = SECCOMP_USER_NOTIF_FLAG_CONTINUE;
+        ioctl(notifyFd, SECCOMP_IOCTL_NOTIF_SEND, reply);
+        
+        if(length > 0 && (flags & O_ACCMODE) != O_WRONLY && (path[0] == '/' || base[0] == '/') &&
+           !addTracedInput(inputs, inputsLength, &inputsCapacity, base, path)){
+            complete = 0;
+        }
+    }
+    
+    if(notifyFd >= 0){
+        close(notifyFd);
+        *traced = complete;
+    }
+    waitForChild(pid, &exitStatus);
+    
+    return WIFEXITED(exitStatus) ? WEXITSTATUS(exitStatus) : 128+WTERMSIG(exitStatus);
+}
+
+
+
+
+/*
+ Runs in the forked child of runTracedCommand. Installs a seccomp filter that passes the
+ child's open and exec calls, and those of everything it starts, to a listener, and sends
+ the listener to the shell over socket. Returns -1 if the filter could not be installed.
+ */
+int installInputTracer(int socket){
+    
+#ifdef TRACE_AUDIT_ARCH
+    struct sock_filter filter[] = {
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, arch)),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, TRACE_AUDIT_ARCH, 1, 0),
+        BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, nr)),
+#ifdef SYS_open
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_open, 0, 1),
+        BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_USER_NOTIF),
+#endif
+#ifdef SYS_openat2
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_openat2, 0, 1),
+        BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_USER_NOTIF),
+#endif
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_openat, 0, 1),
+        BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_USER_NOTIF),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_execve, 0, 1),
+        BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_USER_NOTIF),
+        BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+    };
+    struct sock_fprog program = {sizeof(filter) / sizeof(filter[0]), filter};
+    union{
+        struct cmsghdr header;
+        char space[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr message;
+    struct iovec vector;
+    char marker = 1;
+    int notifyFd;
+    
+    
+    // an unprivileged process may only install a filter if it gives up gaining privileges
+    if(prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) < 0 ||
+       (notifyFd = syscall(SYS_seccomp, SECCOMP_SET_MODE_FILTER, SECCOMP_FILTER_FLAG_NEW_LISTENER, &program)) < 0){
+        return -1;
+    }
+    
+    memset(&message, 0, sizeof(message));
+    memset(&control, 0, sizeof(control));
+    vector.iov_base = &marker;
+    vector.iov_len = 1;
+    message.msg_iov = &vector;
+    message.msg_iovlen = 1;
+    message.msg_control = control.space;
+    message.msg_controllen = sizeof(control.space);
+    CMSG_FIRSTHDR(&message)->cmsg_level = SOL_SOCKET;
+    CMSG_FIRSTHDR(&message)->cmsg_type = SCM_RIGHTS;
+    CMSG_FIRSTHDR(&message)->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(CMSG_FIRSTHDR(&message)), &notifyFd, sizeof(int));
+    
+    // a filter nobody listens to would fail every open, so give up on the command
+    if(sendmsg(socket, &message, 0) != 1){
+        _exit(1);
+    }
+    close(notifyFd);
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+
+
+
+/*
+ Appends base and path, joined by a slash when base is not empty, to the traced inputs
+ unless the path is under /proc, /dev or /sys, whose contents are not files the output
+ can depend on. Returns 0 if there was no memory for it.
+ */
+int addTracedInput(char **inputs, size_t *inputsLength, size_t *inputsCapacity, const char *base, const char *path){
+    
+    size_t baseLength = strlen(base), pathLength = strlen(path), needed;
+    char *grown;
+    const char *full = base[0] ? base : path;
+    
+    
+    if(strncmp(full, "/proc/", 6) == 0 || strncmp(full, "/dev/", 5) == 0 || strncmp(full, "/sys/", 5) == 0){
+        return 1;
+    }
+    
+    needed = *inputsLength + baseLength + 1 + pathLength + 1;
+    if(needed > *inputsCapacity){
+        grown = realloc(*inputs, needed*2);
+        if(!grown){
+            return 0;
+        }
+        *inputs = grown;
+        *inputsCapacity = needed*2;
+    }
+    
+    if(baseLength){
+        memcpy(*inputs+*inputsLength, base, baseLength);
+        (*inputs)[*inputsLength+baseLength] = '/';
+        *inputsLength += baseLength+1;
+    }
+    memcpy(*inputs+*inputsLength, path, pathLength+1);
+    *inputsLength += pathLength+1;
+    return 1;
+}
+
+
 
 
 
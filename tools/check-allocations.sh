@@ -0,0 +1,50 @@
+#!/bin/sh
+#
+# check-allocations.sh - fail if the shell allocates once it has warmed up.
+#
+# usage: tools/check-allocations.sh [repetitions]
+#
+# Builds microshell with -DCHECK_ALLOCATIONS, which replaces malloc, calloc, realloc
+# and free with versions that abort the shell process on any call outside warm-up or a
+# configuration reload, then runs a script that repeats the same mix of lines
+# (pipelines, redirects, chains, builtins, arrays, tests and background jobs) the given
+# number of times (100 by default). Any allocation that grows with the number of lines
+# run aborts the shell and fails the check. The replacement allocator calls glibc's
+# __libc_malloc and friends, so the check needs a glibc build.
+
+set -u
+
+repetitions=${1:-100}
+root=$(cd "$(dirname "$0")/.." && pwd)
+dir=$(mktemp -d /tmp/msalloc-XXXXXX)
+trap 'rm -rf "$dir"' EXIT
+
+cc -O2 -DCHECK_ALLOCATIONS -o "$dir/microshell" "$root/microshell.c" || exit 1
+
+seq 1 2000 > "$dir/data"
+i=0
+while [ "$i" -lt "$repetitions" ]; do
+    cat >> "$dir/script" <<EOF
+echo line $i > $dir/out
+cat $dir/data | sort -n | tail -3 >> $dir/out
+grep -F 5 $dir/data | cut -f 1 | head -20 > $dir/out
+wc -l < $dir/data > $dir/out && true || false
+false || echo fallback > $dir/out
+array nums one two three
+[[ \${nums[1]} == "t*" ]] && echo match > $dir/out
+jobs > $dir/out
+overhead > $dir/out
+sleep 0 &
+time true 2> $dir/out
+EOF
+    i=$((i+1))
+done
+
+MICROSHELL_FUSION=1 MICROSHELLRC=/dev/null "$dir/microshell" "$dir/script" > /dev/null 2> "$dir/errors"
+status=$?
+if [ "$status" -ge 128 ] || grep -q "Error! Heap" "$dir/errors"; then
+    cat "$dir/errors" >&2
+    echo "FAIL: the shell allocated after warm-up (exit status $status)" >&2
+    exit 1
+fi
+echo "ok: $repetitions repetitions of $(($(wc -l < "$dir/script") / repetitions)) lines ran without allocating"
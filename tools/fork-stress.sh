@@ -0,0 +1,104 @@
+#!/bin/sh
+#
+# fork-stress.sh - check that forks held up by the process limit are retried.
+#
+# usage: tools/fork-stress.sh
+#
+# Builds microshell and runs two scripts under an RLIMIT_NPROC that leaves room for the
+# shell and one background job (a forked shell and its sleep), so a foreground command
+# finds no process to spare. The script holds the command back on a fifo until the job's
+# sleep is running, so the command's fork always meets a full limit:
+#
+#   retry  the job sleeps 0.1 s, less than the backoff; the command's fork is retried,
+#          wakes when the job exits and succeeds, and jobs counts retries but no failure
+#   fail   the job sleeps 2 s; the command fails once the backoff (1+2+...+128 ms, about
+#          255 ms) runs out, the shell reports the error and carries on
+#
+# The limit counts every thread of the user, and root is exempt from it, so when run
+# as root the scripts run through setpriv as a uid no other process uses. Needs prlimit
+# and setpriv from util-linux.
+
+set -u
+
+root=$(cd "$(dirname "$0")/.." && pwd)
+dir=$(mktemp -d /tmp/msfork-XXXXXX)
+trap 'rm -rf "$dir"' EXIT
+chmod 755 "$dir"
+
+cc -O2 -o "$dir/microshell" "$root/microshell.c" || exit 1
+
+if [ "$(id -u)" -eq 0 ]; then
+    uid=59999
+    run="setpriv --reuid=$uid --regid=$uid --clear-groups"
+else
+    run=""
+    uid=$(id -u)
+fi
+
+echo "jobs 4 4" > "$dir/rc"
+mkfifo -m 644 "$dir/ready"
+cat > "$dir/retry" <<EOF
+sleep 0.1 > /dev/null &
+jobs < $dir/ready > /dev/null
+echo command ran
+jobs
+EOF
+cat > "$dir/fail" <<EOF
+sleep 2 > /dev/null &
+jobs < $dir/ready > /dev/null
+echo command ran
+jobs
+EOF
+chmod 644 "$dir/rc" "$dir/retry" "$dir/fail"
+chmod 755 "$dir/microshell"
+
+
+# prints the number of threads the uid runs
+countTasks(){
+    grep -l "^Uid:[[:space:]]*$uid[[:space:]]" /proc/[0-9]*/task/*/status 2>/dev/null | wc -l
+}
+
+
+# runs a script under the limit; prints its output and sets elapsed to its wall time in ms
+runLimited(){
+    others=$(countTasks)
+    # opens the fifo once the shell, the job's shell and its sleep run, or after 2 s
+    (
+        tries=0
+        while [ "$(countTasks)" -lt $((others + 3)) ] && [ "$tries" -lt 200 ]; do
+            sleep 0.01
+            tries=$((tries+1))
+        done
+        : > "$dir/ready"
+    ) &
+    start=$(date +%s%N)
+    $run prlimit --nproc=$((others + 3)) env MICROSHELLRC="$dir/rc" "$dir/microshell" "$dir/$1" \
+        > "$dir/$1.out" 2>&1
+    wait
+    elapsed=$((($(date +%s%N) - start) / 1000000))
+    sed 's/^/    /' "$dir/$1.out"
+}
+
+failed=0
+
+echo "retry: a fork that waits for a background job to exit"
+runLimited retry
+if grep -q "command ran" "$dir/retry.out" && grep -q "fork failures 0" "$dir/retry.out" &&
+   ! grep -q "fork retries 0," "$dir/retry.out"; then
+    echo "ok: the command ran after its fork was retried (${elapsed} ms)"
+else
+    echo "FAIL: expected the command to run after some retries and no failure"
+    failed=1
+fi
+
+echo "fail: a fork that runs out of retries"
+runLimited fail
+if ! grep -q "command ran" "$dir/fail.out" && grep -q "Error! Could not fork process for command 'echo'" "$dir/fail.out" &&
+   grep -q "fork failures 1" "$dir/fail.out" && [ "$elapsed" -ge 250 ] && [ "$elapsed" -lt 2000 ]; then
+    echo "ok: the command failed after the backoff, ${elapsed} ms after the script started"
+else
+    echo "FAIL: expected one failure reported after about 255 ms (took ${elapsed} ms)"
+    failed=1
+fi
+
+exit $failed
@@ -0,0 +1,698 @@
+/*
+ schedsim.c
+ ---
+ Replays recorded jobs against the shell's background job scheduler in virtual time, so
+ job slots, queue limits, a memory admission threshold and the order queued jobs are
+ started in can be tuned without running the workload again.
+
+ Build and run from the repository root:
+
+   cc -O2 -o schedsim tools/schedsim.c -lm
+   ./schedsim [-c cores] [-j slots,...] [-q queue,...] [-m memory-MB] [-p fifo,sjf,ljf] trace...
+
+ A trace is either the output of a shell run with MICROSHELL_TRACE set, or a job list
+ written by hand. From the shell's trace every top-level chain becomes a job with its
+ wall time, CPU time and peak resident set. Foreground chains run one after another, and
+ a background job depends on the foreground chain that finished before it was submitted;
+ the pauses between them are kept. A job list has one job per line:
+
+   name fg|job delay-s runtime-s cpu-s rss-kB [after=name,name...]
+
+ where a job is released delay seconds after the jobs it runs after have finished (or
+ after the start). Foreground jobs start when released; background jobs are refused if
+ slots+queue jobs are already queued or running, wait in the queue for a free slot, and
+ with -m also for enough memory. Running jobs share the cores: when they need more CPU
+ than there is, all of them slow down in proportion.
+
+ Every combination of policy, slots and queue limit is simulated and reported with its
+ makespan, CPU utilization and the delay background jobs spent queued. The first row is
+ what was recorded, when the trace holds it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <math.h>
+
+
+#define MAX_LINE_LEN 1048576
+#define MAX_NAME_LEN 64
+#define MAX_SETTINGS 32
+#define EPSILON 1e-9
+
+// states of a job during a simulation
+#define JOB_PENDING 0
+#define JOB_QUEUED 1
+#define JOB_RUNNING 2
+#define JOB_DONE 3
+#define JOB_REFUSED 4
+
+// orders in which queued jobs get free slots
+#define POLICY_FIFO 0
+#define POLICY_SJF 1
+#define POLICY_LJF 2
+
+
+// a recorded job; times are in seconds
+typedef struct _job{
+    char name[MAX_NAME_LEN];
+    int background;
+    double delay;
+    double runtime;
+    double cpu;
+    long rssKb;
+    int *after;
+    int numAfter;
+    double recordedStart, recordedEnd, recordedQueued;
+} job_t;
+
+
+// the state of a job during a simulation
+typedef struct _simJob{
+    int state;
+    int waitingFor;
+    double releaseAt;
+    double releasedAt;
+    double remaining;
+    double start, end;
+} sim_job_t;
+
+
+// a span read from the shell's trace
+typedef struct _span{
+    char spanId[17];
+    char parentId[17];
+    char name[MAX_NAME_LEN];
+    double start, end, submitted;
+    double cpu;
+    long rssKb;
+} span_t;
+
+
+// what one simulation measured
+typedef struct _outcome{
+    double makespan;
+    double utilization;
+    double queueMean, queueP95, queueMax;
+    int refused;
+    long peakRssKb;
+} outcome_t;
+
+
+
+int readTrace(const char *path);
+int parseSpans(const char *line);
+const char *findField(const char *start, const char *end, const char *key);
+void jobsFromSpans(void);
+int addJob(const char *name, int background, double delay, double runtime, double cpu, long rssKb);
+void addDependency(int job, int after);
+int findJob(const char *name);
+void simulate(int policy, int slots, int queue, long memoryKb, int cores, outcome_t *outcome);
+void releaseDependents(sim_job_t *sim, int job, double now);
+int pickQueued(const sim_job_t *sim, int policy, long rssFree, int anyRunning);
+int parseList(const char *text, int *values);
+int compareDoubles(const void *a, const void *b);
+
+
+job_t *jobs = 0;
+int numJobs = 0, jobCapacity = 0;
+
+span_t *spans = 0;
+int numSpans = 0, spanCapacity = 0;
+
+const char *policyNames[] = {"fifo", "sjf", "ljf"};
+
+
+
+/*
+ Main function. Reads the traces and prints the outcome of every combination of the
+ requested settings.
+ */
+int main(int argc, char **argv){
+
+    int cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int slots[MAX_SETTINGS], queues[MAX_SETTINGS], policies[3];
+    int numSlots, numQueues = 1, numPolicies = 0;
+    long memoryKb = 0;
+    const char *policyList = "fifo,sjf,ljf";
+    const char *name;
+    double first = INFINITY, last = 0, totalCpu = 0;
+    double *delays;
+    int numDelays = 0;
+    outcome_t outcome;
+    int opt, i, p, s, q;
+
+
+    slots[0] = cores;
+    numSlots = 1;
+    queues[0] = 64;
+    while((opt = getopt(argc, argv, "c:j:q:m:p:")) != -1){
+        if(opt == 'c'){
+            cores = atoi(optarg);
+        }
+        else if(opt == 'j'){
+            numSlots = parseList(optarg, slots);
+        }
+        else if(opt == 'q'){
+            numQueues = parseList(optarg, queues);
+        }
+        else if(opt == 'm'){
+            memoryKb = atol(optarg) * 1024;
+        }
+        else if(opt == 'p'){
+            policyList = optarg;
+        }
+        else{
+            optind = argc+1;
+            break;
+        }
+    }
+    for(name=policyList; *name; name += strcspn(name, ",") + (name[strcspn(name, ",")] == ',')){
+        for(p=0; p < 3 && (strlen(policyNames[p]) != strcspn(name, ",") ||
+                           strncmp(name, policyNames[p], strcspn(name, ",")) != 0); ++p);
+        if(p == 3 || numPolicies == 3){
+            optind = argc+1;
+            break;
+        }
+        policies[numPolicies++] = p;
+    }
+    if(optind >= argc || cores < 1 || numSlots < 1 || numQueues < 1 || numPolicies < 1){
+        fprintf(stderr, "Usage: %s [-c cores] [-j slots,...] [-q queue,...] [-m memory-MB] "
+                "[-p fifo,sjf,ljf] trace...\n", argv[0]);
+        return 1;
+    }
+
+    for(i=optind; i < argc; ++i){
+        if(!readTrace(argv[i])){
+            return 1;
+        }
+    }
+    jobsFromSpans();
+    if(numJobs == 0){
+        fprintf(stderr, "Error! The traces hold no jobs.\n");
+        return 1;
+    }
+
+
+    printf("%d jobs, %d cores%s\n\n", numJobs, cores, memoryKb ? ", memory admission" : "");
+    printf("%-9s %5s %5s %11s %6s %12s %12s %12s %7s %12s\n", "policy", "slots", "queue", "makespan s",
+           "util %", "queue avg s", "queue p95 s", "queue max s", "refused", "peak RSS MB");
+
+    // the recorded run, when the trace has timestamps
+    delays = malloc(numJobs * sizeof(double));
+    for(i=0; i < numJobs; ++i){
+        if(jobs[i].recordedEnd > 0){
+            first = jobs[i].recordedStart - jobs[i].recordedQueued < first ?
+                    jobs[i].recordedStart - jobs[i].recordedQueued : first;
+            last = jobs[i].recordedEnd > last ? jobs[i].recordedEnd : last;
+            if(jobs[i].background){
+                delays[numDelays++] = jobs[i].recordedQueued;
+            }
+        }
+        totalCpu += jobs[i].cpu;
+    }
+    if(last > 0){
+        qsort(delays, numDelays, sizeof(double), compareDoubles);
+        outcome.queueMean = 0;
+        for(i=0; i < numDelays; ++i){
+            outcome.queueMean += delays[i] / numDelays;
+        }
+        printf("%-9s %5s %5s %11.2f %6.1f %12.3f %12.3f %12.3f %7s %12s\n", "recorded", "-", "-", last - first,
+               100 * totalCpu / (cores * (last - first)), outcome.queueMean,
+               numDelays ? delays[(int)ceil(0.95 * numDelays) - 1] : 0, numDelays ? delays[numDelays-1] : 0, "-", "-");
+    }
+    free(delays);
+
+    for(p=0; p < numPolicies; ++p){
+        for(s=0; s < numSlots; ++s){
+            for(q=0; q < numQueues; ++q){
+                simulate(policies[p], slots[s], queues[q], memoryKb, cores, &outcome);
+                printf("%-9s %5d %5d %11.2f %6.1f %12.3f %12.3f %12.3f %7d %12.1f\n", policyNames[policies[p]],
+                       slots[s], queues[q], outcome.makespan, 100 * outcome.utilization, outcome.queueMean,
+                       outcome.queueP95, outcome.queueMax, outcome.refused, outcome.peakRssKb / 1024.0);
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+
+
+/*
+ Reads a trace file: lines of the shell's OTLP-JSON export are collected as spans, any
+ other line that is not blank or a comment is a job. Returns 1 on success or 0 on error.
+ */
+int readTrace(const char *path){
+
+    static char line[MAX_LINE_LEN];
+    char name[MAX_NAME_LEN], kind[8], after[MAX_LINE_LEN];
+    double delay, runtime, cpu;
+    long rssKb;
+    int lineNumber = 0, fields, job, dependency;
+    char *item;
+    FILE *trace = fopen(path, "r");
+
+    if(!trace){
+        fprintf(stderr, "Error! Could not open trace '%s'.\n", path);
+        return 0;
+    }
+    while(fgets(line, MAX_LINE_LEN, trace)){
+        ++lineNumber;
+        if(line[0] == '{'){
+            parseSpans(line);
+            continue;
+        }
+        if(line[strspn(line, " \t")] == '#' || line[strspn(line, " \t\n")] == 0){
+            continue;
+        }
+
+        after[0] = 0;
+        fields = sscanf(line, "%63s %7s %lf %lf %lf %ld after=%s", name, kind, &delay, &runtime, &cpu, &rssKb, after);
+        if(fields < 6 || (strcmp(kind, "fg") != 0 && strcmp(kind, "job") != 0)){
+            fprintf(stderr, "Error! Line %d of '%s' is not a job.\n", lineNumber, path);
+            fclose(trace);
+            return 0;
+        }
+        job = addJob(name, kind[0] == 'j', delay, runtime, cpu, rssKb);
+        for(item=strtok(after, ","); item; item=strtok(0, ",")){
+            dependency = findJob(item);
+            if(dependency < 0){
+                fprintf(stderr, "Error! Line %d of '%s' runs after unknown job '%s'.\n", lineNumber, path, item);
+                fclose(trace);
+                return 0;
+            }
+            addDependency(job, dependency);
+        }
+    }
+    fclose(trace);
+    return 1;
+}
+
+
+
+
+/*
+ Collects the spans of one OTLP-JSON export request as written by the shell. Returns the
+ number of spans found.
+ */
+int parseSpans(const char *line){
+
+    const char *start, *end, *field;
+    span_t *span;
+    int found = 0;
+
+    for(start=strstr(line, "{\"traceId\":"); start && *start; start=end){
+        end = strstr(start+1, "{\"traceId\":");
+        if(!end){
+            end = start+strlen(start);
+        }
+        if(numSpans == spanCapacity){
+            spanCapacity = spanCapacity ? 2*spanCapacity : 1024;
+            spans = realloc(spans, spanCapacity * sizeof(span_t));
+        }
+        span = spans+numSpans;
+        memset(span, 0, sizeof(*span));
+
+        if((field = findField(start, end, "\"spanId\":\""))){
+            sscanf(field, "%16[0-9a-f]", span->spanId);
+        }
+        if((field = findField(start, end, "\"parentSpanId\":\""))){
+            sscanf(field, "%16[0-9a-f]", span->parentId);
+        }
+        if((field = findField(start, end, "\"name\":\""))){
+            snprintf(span->name, MAX_NAME_LEN, "%.*s", (int)strcspn(field, "\""), field);
+        }
+        if((field = findField(start, end, "\"startTimeUnixNano\":\""))){
+            span->start = strtoull(field, 0, 10) / 1e9;
+        }
+        if((field = findField(start, end, "\"endTimeUnixNano\":\""))){
+            span->end = strtoull(field, 0, 10) / 1e9;
+        }
+        if((field = findField(start, end, "\"microshell.cpu_us\",\"value\":{\"intValue\":\""))){
+            span->cpu = strtoull(field, 0, 10) / 1e6;
+        }
+        else{
+            span->cpu = span->end - span->start; // traces without usage count one busy core
+        }
+        if((field = findField(start, end, "\"microshell.max_rss_kb\",\"value\":{\"intValue\":\""))){
+            span->rssKb = atol(field);
+        }
+        if((field = findField(start, end, "\"microshell.job.submitted_unix_nano\",\"value\":{\"intValue\":\""))){
+            span->submitted = strtoull(field, 0, 10) / 1e9;
+        }
+        ++numSpans;
+        ++found;
+    }
+    return found;
+}
+
+
+
+
+/*
+ Returns the text following key between start and end, or 0 if key is not there.
+ */
+const char *findField(const char *start, const char *end, const char *key){
+
+    const char *found = strstr(start, key);
+
+    return (found && found < end) ? found+strlen(key) : 0;
+}
+
+
+
+
+/*
+ Turns the top-level chain spans into jobs. Chains whose parent is another recorded span
+ ran inside a command, such as a nested script, and are part of that command's job.
+ */
+void jobsFromSpans(void){
+
+    int *order, numChains = 0, lastForeground = -1;
+    double origin = INFINITY, released;
+    int i, j, known, job;
+    span_t *span;
+
+    order = malloc((numSpans+1) * sizeof(int));
+    for(i=0; i < numSpans; ++i){
+        if(strncmp(spans[i].name, "chain: ", 7) != 0){
+            continue;
+        }
+        for(known=0, j=0; j < numSpans && !known; ++j){
+            known = strcmp(spans[j].spanId, spans[i].parentId) == 0;
+        }
+        if(known){
+            continue;
+        }
+
+        // order chains by the time they were handed to the shell
+        released = spans[i].submitted ? spans[i].submitted : spans[i].start;
+        for(j=numChains; j > 0; --j){
+            span = spans+order[j-1];
+            if((span->submitted ? span->submitted : span->start) <= released){
+                break;
+            }
+            order[j] = order[j-1];
+        }
+        order[j] = i;
+        ++numChains;
+        origin = released < origin ? released : origin;
+    }
+
+    for(i=0; i < numChains; ++i){
+        span = spans+order[i];
+        released = span->submitted ? span->submitted : span->start;
+        job = addJob(span->name+7, span->submitted != 0, 0, span->end - span->start, span->cpu, span->rssKb);
+        jobs[job].recordedStart = span->start;
+        jobs[job].recordedEnd = span->end;
+        jobs[job].recordedQueued = span->submitted ? span->start - span->submitted : 0;
+
+        // the shell reads the next line once a foreground chain finishes
+        if(lastForeground >= 0){
+            addDependency(job, lastForeground);
+            jobs[job].delay = released - jobs[lastForeground].recordedEnd;
+        }
+        else{
+            jobs[job].delay = released - origin;
+        }
+        jobs[job].delay = jobs[job].delay < 0 ? 0 : jobs[job].delay;
+        if(!span->submitted){
+            lastForeground = job;
+        }
+    }
+    free(order);
+}
+
+
+
+
+/*
+ Adds a job and returns its index.
+ */
+int addJob(const char *name, int background, double delay, double runtime, double cpu, long rssKb){
+
+    job_t *job;
+
+    if(numJobs == jobCapacity){
+        jobCapacity = jobCapacity ? 2*jobCapacity : 1024;
+        jobs = realloc(jobs, jobCapacity * sizeof(job_t));
+    }
+    job = jobs+numJobs;
+    memset(job, 0, sizeof(*job));
+    snprintf(job->name, MAX_NAME_LEN, "%s", name);
+    job->background = background;
+    job->delay = delay;
+    job->runtime = runtime > 0 ? runtime : 0;
+    job->cpu = cpu > 0 ? cpu : 0;
+    job->rssKb = rssKb;
+    return numJobs++;
+}
+
+
+
+
+/*
+ Makes job wait for the job after to finish before it is released.
+ */
+void addDependency(int job, int after){
+
+    jobs[job].after = realloc(jobs[job].after, (jobs[job].numAfter+1) * sizeof(int));
+    jobs[job].after[jobs[job].numAfter++] = after;
+}
+
+
+
+
+/*
+ Returns the index of the most recent job with the given name, or -1.
+ */
+int findJob(const char *name){
+
+    int i;
+
+    for(i=numJobs-1; i >= 0 && strcmp(jobs[i].name, name) != 0; --i);
+    return i;
+}
+
+
+
+
+/*
+ Runs the jobs in virtual time under one scheduler setting. Time advances from event to
+ event: a job being released, or a running job finishing at the speed the shared cores
+ allow.
+ */
+void simulate(int policy, int slots, int queue, long memoryKb, int cores, outcome_t *outcome){
+
+    sim_job_t *sim = calloc(numJobs, sizeof(sim_job_t));
+    double *delays = malloc(numJobs * sizeof(double));
+    double now = 0, step, demand, speed, cpuDone = 0;
+    long rssUsed = 0;
+    int queued = 0, runningJobs = 0, runningBackground = 0, finished = 0, numDelays = 0;
+    int changed, next, i;
+
+    memset(outcome, 0, sizeof(*outcome));
+    for(i=0; i < numJobs; ++i){
+        sim[i].waitingFor = jobs[i].numAfter;
+        sim[i].releaseAt = jobs[i].delay;
+        sim[i].remaining = jobs[i].runtime;
+    }
+
+    while(finished < numJobs){
+
+        // release, refuse, start and finish jobs until nothing changes at this instant
+        do{
+            changed = 0;
+            for(i=0; i < numJobs; ++i){
+                if(sim[i].state == JOB_PENDING && sim[i].waitingFor == 0 && sim[i].releaseAt <= now + EPSILON){
+                    sim[i].releasedAt = now;
+                    changed = 1;
+                    if(!jobs[i].background){
+                        sim[i].state = JOB_RUNNING;
+                        sim[i].start = now;
+                        rssUsed += jobs[i].rssKb;
+                        ++runningJobs;
+                    }
+                    else if(queued + runningBackground >= slots + queue){
+                        sim[i].state = JOB_REFUSED;
+                        sim[i].end = now;
+                        ++outcome->refused;
+                        ++finished;
+                        releaseDependents(sim, i, now);
+                    }
+                    else{
+                        sim[i].state = JOB_QUEUED;
+                        ++queued;
+                    }
+                }
+            }
+
+            while(runningBackground < slots && queued > 0 &&
+                  (next = pickQueued(sim, policy, memoryKb ? memoryKb - rssUsed : -1, runningJobs > 0)) >= 0){
+                sim[next].state = JOB_RUNNING;
+                sim[next].start = now;
+                delays[numDelays++] = now - sim[next].releasedAt;
+                rssUsed += jobs[next].rssKb;
+                --queued;
+                ++runningJobs;
+                ++runningBackground;
+                changed = 1;
+            }
+            outcome->peakRssKb = rssUsed > outcome->peakRssKb ? rssUsed : outcome->peakRssKb;
+
+            for(i=0; i < numJobs; ++i){
+                if(sim[i].state == JOB_RUNNING && sim[i].remaining <= EPSILON){
+                    sim[i].state = JOB_DONE;
+                    sim[i].end = now;
+                    cpuDone += jobs[i].cpu;
+                    rssUsed -= jobs[i].rssKb;
+                    --runningJobs;
+                    runningBackground -= jobs[i].background;
+                    ++finished;
+                    releaseDependents(sim, i, now);
+                    changed = 1;
+                }
+            }
+        } while(changed && finished < numJobs);
+        if(finished == numJobs){
+            break;
+        }
+
+        // running jobs share the cores in proportion to the CPU they need
+        demand = 0;
+        for(i=0; i < numJobs; ++i){
+            if(sim[i].state == JOB_RUNNING && jobs[i].runtime > 0){
+                demand += jobs[i].cpu / jobs[i].runtime;
+            }
+        }
+        speed = demand > cores ? cores / demand : 1;
+
+        step = INFINITY;
+        for(i=0; i < numJobs; ++i){
+            if(sim[i].state == JOB_RUNNING && sim[i].remaining / speed < step){
+                step = sim[i].remaining / speed;
+            }
+            else if(sim[i].state == JOB_PENDING && sim[i].waitingFor == 0 && sim[i].releaseAt - now < step){
+                step = sim[i].releaseAt - now;
+            }
+        }
+        if(step == INFINITY){
+            fprintf(stderr, "Error! %d jobs can never start; is a job larger than the memory limit?\n",
+                    numJobs - finished);
+            break;
+        }
+
+        for(i=0; i < numJobs; ++i){
+            if(sim[i].state == JOB_RUNNING){
+                sim[i].remaining -= step * speed;
+            }
+        }
+        now += step;
+    }
+
+    outcome->makespan = now;
+    outcome->utilization = now > 0 ? cpuDone / (cores * now) : 0;
+    if(numDelays > 0){
+        qsort(delays, numDelays, sizeof(double), compareDoubles);
+        for(i=0; i < numDelays; ++i){
+            outcome->queueMean += delays[i] / numDelays;
+        }
+        outcome->queueP95 = delays[(int)ceil(0.95 * numDelays) - 1];
+        outcome->queueMax = delays[numDelays-1];
+    }
+    free(sim);
+    free(delays);
+}
+
+
+
+
+/*
+ Counts the finish of job at time now towards the jobs that run after it, which are
+ released their delay after the last of their dependencies finishes.
+ */
+void releaseDependents(sim_job_t *sim, int job, double now){
+
+    int i, k;
+
+    for(i=0; i < numJobs; ++i){
+        for(k=0; sim[i].state == JOB_PENDING && k < jobs[i].numAfter; ++k){
+            if(jobs[i].after[k] == job){
+                --sim[i].waitingFor;
+                if(now + jobs[i].delay > sim[i].releaseAt){
+                    sim[i].releaseAt = now + jobs[i].delay;
+                }
+            }
+        }
+    }
+}
+
+
+
+
+/*
+ Returns the queued job the policy starts next, or -1 if none can start. With a memory
+ limit (rssFree not negative) a job only starts if it fits in rssFree kilobytes or nothing
+ else is running; under fifo the oldest job then blocks the ones behind it, while the
+ other policies pass over jobs that do not fit.
+ */
+int pickQueued(const sim_job_t *sim, int policy, long rssFree, int anyRunning){
+
+    int best = -1, i;
+
+    for(i=0; i < numJobs; ++i){
+        if(sim[i].state != JOB_QUEUED){
+            continue;
+        }
+        if(policy != POLICY_FIFO && rssFree >= 0 && anyRunning && jobs[i].rssKb > rssFree){
+            continue;
+        }
+        if(best < 0 ||
+           (policy == POLICY_FIFO && sim[i].releasedAt < sim[best].releasedAt) ||
+           (policy == POLICY_SJF && jobs[i].runtime < jobs[best].runtime) ||
+           (policy == POLICY_LJF && jobs[i].runtime > jobs[best].runtime)){
+            best = i;
+        }
+    }
+    if(best >= 0 && rssFree >= 0 && anyRunning && jobs[best].rssKb > rssFree){
+        return -1;
+    }
+    return best;
+}
+
+
+
+
+/*
+ Parses a comma separated list of at most MAX_SETTINGS positive numbers into values and
+ returns how many there were, or 0 if one was not positive.
+ */
+int parseList(const char *text, int *values){
+
+    int count = 0;
+
+    while(*text && count < MAX_SETTINGS){
+        values[count] = atoi(text);
+        if(values[count++] <= 0){
+            return 0;
+        }
+        text += strcspn(text, ",");
+        text += (*text == ',');
+    }
+    return count;
+}
+
+
+
+
+/*
+ Orders doubles ascending for qsort.
+ */
+int compareDoubles(const void *a, const void *b){
+
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}